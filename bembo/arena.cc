@@ -0,0 +1,47 @@
+#include <utility>
+
+#include "bembo/arena.h"
+
+namespace bembo {
+
+namespace {
+
+thread_local DocArena *current_arena = nullptr;
+
+} // namespace
+
+DocArena::DocArena() : memory{} {}
+
+DocArena::DocArena(size_t initial_size) : memory{initial_size} {}
+
+void *DocArena::allocate(size_t size, size_t align) {
+    return this->memory.allocate(size, align);
+}
+
+void DocArena::adopt(Doc &child) {
+    if (!child.counted()) {
+        return;
+    }
+
+    // Move the reference held by `child` into `retained`, and leave `child` as an unowned copy of it.
+    auto &owner = this->retained.emplace_back();
+    owner.short_text_data = child.short_text_data;
+    owner.value = child.value;
+    child.mark_unowned();
+}
+
+DocArena *DocArena::exchange_current(DocArena *arena) {
+    return std::exchange(current_arena, arena);
+}
+
+DocArena::Scope::Scope(DocArena &arena) : prev{DocArena::exchange_current(&arena)} {}
+
+DocArena::Scope::~Scope() {
+    DocArena::exchange_current(this->prev);
+}
+
+DocArena *DocArena::current() {
+    return current_arena;
+}
+
+} // namespace bembo
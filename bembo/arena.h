@@ -0,0 +1,69 @@
+#ifndef BEMBO_ARENA_H
+#define BEMBO_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+#include "bembo/doc.h"
+
+namespace bembo {
+
+// A bump allocator for Doc nodes. While a `DocArena::Scope` is active, all docs constructed on that thread are
+// allocated in the arena instead of the heap. Arena-owned docs skip refcounting entirely, and are all released at once
+// when the arena is destroyed; docs allocated in an arena must not be used after it has been destroyed.
+//
+// Each thread has its own current arena, so worker threads can build fragments in parallel, each in their own arena.
+class DocArena final {
+private:
+    friend class Doc;
+
+    std::pmr::monotonic_buffer_resource memory;
+
+    // Heap allocated docs that are referenced by nodes in the arena, released when the arena is destroyed.
+    std::vector<Doc> retained;
+
+    // Take over the reference held by `child`, when it's refcounted.
+    void adopt(Doc &child);
+
+    // Make `arena` the current arena for this thread, and return the one it replaces.
+    static DocArena *exchange_current(DocArena *arena);
+
+public:
+    DocArena();
+
+    // Construct an arena whose first block is `initial_size` bytes.
+    explicit DocArena(size_t initial_size);
+
+    ~DocArena() = default;
+
+    DocArena(const DocArena &other) = delete;
+    DocArena &operator=(const DocArena &other) = delete;
+
+    // Make `arena` the current arena for this thread for the lifetime of the scope.
+    class Scope final {
+        DocArena *prev;
+
+    public:
+        explicit Scope(DocArena &arena);
+        ~Scope();
+
+        Scope(const Scope &other) = delete;
+        Scope &operator=(const Scope &other) = delete;
+    };
+
+    // The current arena for this thread, or `nullptr` when docs are allocated in the heap.
+    static DocArena *current();
+
+    // Allocate `size` bytes from the arena, which will be released when the arena is destroyed.
+    void *allocate(size_t size, size_t align);
+
+    // The arena as a memory resource.
+    std::pmr::memory_resource *resource() {
+        return &this->memory;
+    }
+};
+
+} // namespace bembo
+
+#endif
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+#include "bembo/async_writer.h"
+
+namespace bembo {
+
+AsyncWriter::AsyncWriter(int fd, size_t buffer_size, size_t max_in_flight)
+    : fd{fd}, buffer_size{std::max<size_t>(buffer_size, 1)}, max_in_flight{std::max<size_t>(max_in_flight, 1)} {
+    this->current.reserve(this->buffer_size);
+    this->thread = std::thread{[this] { this->drain(); }};
+}
+
+AsyncWriter::~AsyncWriter() {
+    this->flush();
+
+    {
+        std::lock_guard lock{this->mutex};
+        this->stopping = true;
+    }
+    this->changed.notify_all();
+    this->thread.join();
+}
+
+void AsyncWriter::submit() {
+    std::unique_lock lock{this->mutex};
+    this->changed.wait(lock, [this] { return this->queue.size() + this->busy < this->max_in_flight; });
+
+    this->queue.emplace_back(std::move(this->current));
+
+    if (this->spare.empty()) {
+        this->current = std::string{};
+        this->current.reserve(this->buffer_size);
+    } else {
+        this->current = std::move(this->spare.back());
+        this->spare.pop_back();
+    }
+
+    lock.unlock();
+    this->changed.notify_all();
+}
+
+void AsyncWriter::drain() {
+    std::unique_lock lock{this->mutex};
+
+    while (true) {
+        this->changed.wait(lock, [this] { return !this->queue.empty() || this->stopping; });
+        if (this->queue.empty()) {
+            return;
+        }
+
+        auto buffer = std::move(this->queue.front());
+        this->queue.pop_front();
+        this->busy = true;
+        auto failed = this->err != 0;
+        lock.unlock();
+
+        int err = 0;
+        std::string_view rest{buffer};
+        while (!failed && !rest.empty()) {
+            auto written = ::write(this->fd, rest.data(), rest.size());
+            if (written < 0) {
+                if (errno != EINTR) {
+                    err = errno;
+                    break;
+                }
+                continue;
+            }
+            rest.remove_prefix(written);
+        }
+
+        buffer.clear();
+
+        lock.lock();
+        if (this->err == 0) {
+            this->err = err;
+        }
+        this->spare.emplace_back(std::move(buffer));
+        this->busy = false;
+        this->changed.notify_all();
+    }
+}
+
+void AsyncWriter::line(int indent) {
+    this->current.push_back('\n');
+    this->current.append(indent, ' ');
+    if (this->current.size() >= this->buffer_size) {
+        this->submit();
+    }
+}
+
+void AsyncWriter::write(std::string_view sv) {
+    this->current.append(sv);
+    if (this->current.size() >= this->buffer_size) {
+        this->submit();
+    }
+}
+
+void AsyncWriter::flush() {
+    if (!this->current.empty()) {
+        this->submit();
+    }
+
+    std::unique_lock lock{this->mutex};
+    this->changed.wait(lock, [this] { return this->queue.empty() && !this->busy; });
+}
+
+int AsyncWriter::error() {
+    std::lock_guard lock{this->mutex};
+    return this->err;
+}
+
+} // namespace bembo
@@ -0,0 +1,79 @@
+#ifndef BEMBO_ASYNC_WRITER_H
+#define BEMBO_ASYNC_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "bembo/doc.h"
+
+namespace bembo {
+
+// Writes to a POSIX file descriptor from a background thread, so that rendering can continue while the output is
+// written. Output is collected in a buffer of `buffer_size` bytes, and full buffers are handed to the background
+// thread to be written out. At most `max_in_flight` full buffers are queued or being written at once, after which
+// further writes block until the background thread catches up.
+//
+// `flush`, which `Doc::render` calls before returning, waits until all output has been written.
+class AsyncWriter final : public Writer {
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1 << 20;
+    static constexpr size_t DEFAULT_MAX_IN_FLIGHT = 2;
+
+private:
+    int fd;
+    const size_t buffer_size;
+    const size_t max_in_flight;
+
+    // The buffer currently being filled, which is only accessed by the rendering thread.
+    std::string current;
+
+    // Everything below is guarded by `mutex`.
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    // Full buffers waiting to be written, and empty ones that can be reused.
+    std::deque<std::string> queue;
+    std::vector<std::string> spare;
+
+    // True while the background thread is writing out a buffer.
+    bool busy{false};
+    bool stopping{false};
+
+    // The `errno` of the first failed write, after which all output is dropped.
+    int err{0};
+
+    std::thread thread;
+
+    // Hand the current buffer to the background thread, blocking if there are too many buffers in flight.
+    void submit();
+
+    // The body of the background thread.
+    void drain();
+
+public:
+    // Write to `fd`, which is not closed by the writer.
+    explicit AsyncWriter(
+        int fd, size_t buffer_size = DEFAULT_BUFFER_SIZE, size_t max_in_flight = DEFAULT_MAX_IN_FLIGHT);
+
+    ~AsyncWriter();
+
+    AsyncWriter(const AsyncWriter &other) = delete;
+    AsyncWriter &operator=(const AsyncWriter &other) = delete;
+
+    void line(int indent) override;
+    void write(std::string_view sv) override;
+    void flush() override;
+
+    // The `errno` value of the first write that failed, or `0` if all writes succeeded.
+    int error();
+};
+
+} // namespace bembo
+
+#endif
@@ -1,11 +1,21 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "bembo/arena.h"
+#include "bembo/async_writer.h"
 #include "bembo/doc.h"
+#include "bembo/fd_writer.h"
+#include "bembo/mmap_writer.h"
 
 using namespace std::literals::string_view_literals;
 
@@ -13,50 +23,239 @@ namespace bembo {
 
 namespace {
 
-constexpr uint64_t TAG_MASK_BITS = 8;
+constexpr uint64_t TAG_MASK_BITS = 4;
 constexpr uint64_t TAG_MASK = (1 << TAG_MASK_BITS) - 1;
 
+constexpr uint64_t UNOWNED_MASK = 1 << TAG_MASK_BITS;
+
+constexpr uint64_t SIZE_SHIFT = detail::SHORT_TEXT_SIZE_SHIFT;
 constexpr uint64_t SIZE_MASK_BITS = 7;
-constexpr uint64_t SIZE_MASK = ((1 << SIZE_MASK_BITS) - 1) << TAG_MASK_BITS;
+constexpr uint64_t SIZE_MASK = ((1 << SIZE_MASK_BITS) - 1) << SIZE_SHIFT;
 
 constexpr uint64_t FLATTENED_MASK_BITS = 1;
-constexpr uint64_t FLATTENED_MASK = ((1 << FLATTENED_MASK_BITS) - 1) << (TAG_MASK_BITS + SIZE_MASK_BITS);
+constexpr uint64_t FLATTENED_MASK = ((1 << FLATTENED_MASK_BITS) - 1) << (SIZE_SHIFT + SIZE_MASK_BITS);
 
-constexpr int METADATA_BITS = TAG_MASK_BITS + SIZE_MASK_BITS + FLATTENED_MASK_BITS;
+constexpr int METADATA_BITS = SIZE_SHIFT + SIZE_MASK_BITS + FLATTENED_MASK_BITS;
 
 // The format of the Doc field is as follows:
 //
-// 0        8         16                                                    64
+// 0    4 5   8         16                                                  64
 // +------------------------------------------------------------------------+
-// |                 shared refcount, or inlined string data                |
-// +--------+-------+-+-----------------------------------------------------+
-// |  tag   |  size |f|         48 bits of pointer to heap object           |
-// +--------+-------+-+-----------------------------------------------------+
+// |           inlined string data, unused for heap allocated tags          |
+// +----+-+---+-------+-+---------------------------------------------------+
+// |tag |u|   |  size |f|         48 bits of pointer to heap object         |
+// +----+-+---+-------+-+---------------------------------------------------+
 //
 // tag:       The `Tag` value for this doc, with odd tags indicating that the object is heap allocated.
+// u:         Whether the heap object is unowned, and must not be refcounted (e.g. because it lives in a `DocArena`).
 // size:      The size of the inlined string case, invalid for all other tags.
 // f:         Whether or not this doc has had `flatten` applied to it.
 // pointer:   A pointer to the heap object whose shape is determined by `tag`.
 //
-// refcount/string data: either a pointer to an atomic refcount shared by heap allocated objects, or up to eight bytes
-// of inlined string data.
+// string data: up to eight bytes of inlined string data.
+//
+// Heap objects all begin with a `Header` that holds their refcount, so that each node is a single allocation.
 
 uint64_t make_tagged(uint16_t tag, void *ptr) {
     return (reinterpret_cast<uint64_t>(ptr) << METADATA_BITS) | static_cast<uint64_t>(tag);
 }
 
-using Concat = std::vector<Doc>;
-using Text = std::string;
+// Allocate storage for a node, from `arena` when one is given.
+void *allocate(DocArena *arena, size_t size, size_t align) {
+    if (arena != nullptr) {
+        return arena->allocate(size, align);
+    }
+    return ::operator new(size);
+}
+
+template <typename T, typename... Args> T *make_node(DocArena *arena, Args &&...args) {
+    return new (allocate(arena, sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+}
+
+#ifdef BEMBO_SINGLE_THREADED_REFCOUNT
+
+// A plain count, for builds whose docs never leave the thread that built them.
+class RefCount final {
+    int count{1};
+
+public:
+    void increment() {
+        ++this->count;
+    }
+
+    // Returns true when this was the last reference.
+    bool decrement() {
+        return --this->count == 0;
+    }
+
+    int load() const {
+        return this->count;
+    }
+};
+
+#else
+
+// An atomic count, allowing docs to be shared between threads. Taking a new reference requires that one is already
+// held, so it needs no ordering; releasing one must happen-before the node is freed by whichever thread drops the last.
+class RefCount final {
+    std::atomic<int> count{1};
+
+public:
+    void increment() {
+        this->count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Returns true when this was the last reference.
+    bool decrement() {
+        return this->count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    int load() const {
+        return this->count.load(std::memory_order_acquire);
+    }
+};
+
+#endif
+
+constexpr uint32_t MAX_WIDTH = (1u << 31) - 1;
+
+// Layout information about a node that doesn't depend on the line length, computed when the node is constructed.
+struct Metrics {
+    // The width of the node when it's flattened, saturating at `MAX_WIDTH`.
+    uint32_t flat_width : 31;
+
+    // True when the node never produces a line break, and is `flat_width` wide whether or not it's flattened.
+    uint32_t single_line : 1;
+
+    // When not flattened: the narrowest the node can be without producing a line break, or `MAX_WIDTH` if it always
+    // breaks.
+    uint32_t unbroken_width : 31;
+
+    // True when the node holds a lazy or generated doc. The other metrics leave those out, as if they were empty, and
+    // `single_line` is always false.
+    uint32_t lazy : 1;
+
+    // When not flattened: the narrowest the text before the node's first line break can be, or `MAX_WIDTH` if it never
+    // breaks.
+    uint32_t break_width;
+};
+
+uint32_t add_widths(uint32_t a, uint32_t b) {
+    return static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(a) + b, MAX_WIDTH));
+}
+
+// Extend the metrics `acc` of a concatenation with those of a doc appended to it.
+void append_metrics(Metrics &acc, const Metrics &next) {
+    acc.flat_width = add_widths(acc.flat_width, next.flat_width);
+    acc.single_line = acc.single_line && next.single_line;
+    acc.break_width = std::min<uint32_t>(acc.break_width, add_widths(acc.unbroken_width, next.break_width));
+    acc.unbroken_width = add_widths(acc.unbroken_width, next.unbroken_width);
+    acc.lazy = acc.lazy || next.lazy;
+}
+
+// The metrics of a choice between the flattened `left` branch and `right`.
+Metrics choice_metrics(const Metrics &left, const Metrics &right) {
+    // Either branch may be chosen when not flattening, so the width is only fixed when both branches agree.
+    Metrics res{};
+    res.flat_width = left.flat_width;
+    res.lazy = left.lazy || right.lazy;
+    res.single_line = !res.lazy && right.single_line && left.flat_width == right.flat_width;
+    res.unbroken_width = std::min<uint32_t>(left.flat_width, right.unbroken_width);
+    res.break_width = right.break_width;
+    return res;
+}
+
+} // namespace
+
+struct Doc::Header {
+    RefCount refs;
+    Metrics metrics{0, 1, 0, 0, MAX_WIDTH};
+};
+
+namespace {
+
+// The text is stored inline, directly after the header.
+struct Text final : Doc::Header {
+    size_t size;
+
+    explicit Text(size_t size) : size{size} {
+        this->metrics.flat_width = add_widths(0, std::min<size_t>(size, MAX_WIDTH));
+        this->metrics.unbroken_width = this->metrics.flat_width;
+    }
+
+    static Text *make(DocArena *arena, std::string_view str) {
+        auto *mem = allocate(arena, sizeof(Text) + str.size(), alignof(Text));
+        auto *text = new (mem) Text{str.size()};
+        std::copy_n(str.begin(), str.size(), text->data());
+        return text;
+    }
+
+    static void destroy(Text *text) {
+        text->~Text();
+        ::operator delete(text);
+    }
+
+    char *data() {
+        return reinterpret_cast<char *>(this + 1);
+    }
+
+    std::string_view view() const {
+        return std::string_view{reinterpret_cast<const char *>(this + 1), this->size};
+    }
+};
+
+// Concat nodes allocated in an arena also allocate their children there.
+struct Concat final : Doc::Header {
+    std::pmr::vector<Doc> docs;
+
+    explicit Concat(std::pmr::memory_resource *mem) : docs{mem} {}
+};
 
 // NOTE: the left side is always flattened implicitly, so lines will be interpreted as a single space.
-struct Choice final {
+struct Choice final : Doc::Header {
     Doc left;
     Doc right;
+
+    Choice(Doc left, Doc right) : left{std::move(left)}, right{std::move(right)} {}
 };
 
-struct Nest final {
+struct Nest final : Doc::Header {
     Doc doc;
     int indent;
+
+    Nest(Doc doc, int indent) : doc{std::move(doc)}, indent{indent} {}
+};
+
+// Lazy nodes are always allocated in the heap, as arenas don't run the destructors of their nodes.
+struct Lazy final : Doc::Header {
+    // Cleared once the doc has been built, releasing anything it captured.
+    std::function<Doc()> make;
+
+    std::once_flag built;
+    Doc doc;
+
+    // The metrics of the built doc including its own lazy docs, in full and up to its first line break, kept the first
+    // time they're measured so that each lazy doc is only walked once.
+    std::once_flag measured;
+    Metrics forced{0, 1, 0, 0, MAX_WIDTH};
+    std::once_flag measured_until_break;
+    Metrics forced_until_break{0, 1, 0, 0, MAX_WIDTH};
+
+    explicit Lazy(std::function<Doc()> make) : make{std::move(make)} {
+        this->metrics.single_line = false;
+        this->metrics.lazy = true;
+    }
+};
+
+// A concatenation whose docs are generated as they're visited. Like `Lazy`, these always live in the heap.
+struct Generated final : Doc::Header {
+    uint32_t size;
+    std::function<Doc(size_t)> make;
+
+    Generated(uint32_t size, std::function<Doc(size_t)> make) : size{size}, make{std::move(make)} {
+        this->metrics.single_line = false;
+        this->metrics.lazy = true;
+    }
 };
 
 } // namespace
@@ -65,28 +264,250 @@ Doc::Tag Doc::tag() const {
     return static_cast<Tag>(this->value & TAG_MASK);
 }
 
-void *Doc::data() const {
-    return reinterpret_cast<void *>(this->value >> METADATA_BITS);
+Doc::Header *Doc::data() const {
+    return reinterpret_cast<Header *>(this->value >> METADATA_BITS);
+}
+
+uint32_t Doc::flat_width() const {
+    switch (this->tag()) {
+    case Tag::Nil:
+        return 0;
+
+    case Tag::Line:
+        return 1;
+
+    case Tag::ShortText:
+        return (this->value & SIZE_MASK) >> SIZE_SHIFT;
+
+    default:
+        return this->data()->metrics.flat_width;
+    }
+}
+
+uint32_t Doc::unbroken_width() const {
+    switch (this->tag()) {
+    case Tag::Nil:
+    case Tag::ShortText:
+        return this->flat_width();
+
+    case Tag::Line:
+        return MAX_WIDTH;
+
+    default:
+        return this->data()->metrics.unbroken_width;
+    }
+}
+
+uint32_t Doc::break_width() const {
+    switch (this->tag()) {
+    case Tag::Nil:
+    case Tag::ShortText:
+        return MAX_WIDTH;
+
+    case Tag::Line:
+        return 0;
+
+    default:
+        return this->data()->metrics.break_width;
+    }
+}
+
+bool Doc::single_line() const {
+    switch (this->tag()) {
+    case Tag::Nil:
+    case Tag::ShortText:
+        return true;
+
+    case Tag::Line:
+        return false;
+
+    default:
+        return this->data()->metrics.single_line;
+    }
+}
+
+bool Doc::has_lazy() const {
+    switch (this->tag()) {
+    case Tag::Nil:
+    case Tag::Line:
+    case Tag::ShortText:
+        return false;
+
+    default:
+        return this->data()->metrics.lazy;
+    }
+}
+
+// Computes the metrics of docs, either from what's cached in their nodes, or by building the lazy docs within them.
+class ForcedMetrics final {
+public:
+    // The metrics of a doc whose metrics are `metrics`, once it's been flattened: it never breaks, so it's always as
+    // wide as its flattened width.
+    static Metrics flattened(Metrics metrics) {
+        metrics.single_line = !metrics.lazy;
+        metrics.unbroken_width = metrics.flat_width;
+        metrics.break_width = MAX_WIDTH;
+        return metrics;
+    }
+
+    // The metrics cached for `doc`, which leave out any lazy docs.
+    static Metrics cached(const Doc &doc) {
+        Metrics res{};
+        res.flat_width = doc.flat_width();
+        res.single_line = doc.single_line();
+        res.unbroken_width = doc.unbroken_width();
+        res.lazy = doc.has_lazy();
+        res.break_width = doc.break_width();
+        return doc.is_flattened() ? ForcedMetrics::flattened(res) : res;
+    }
+
+    // The metrics of `doc` including its lazy docs, building any that haven't been built yet. Only the parts of the
+    // doc that hold lazy docs are walked.
+    static Metrics of(const Doc &doc) {
+        if (!doc.has_lazy()) {
+            return ForcedMetrics::cached(doc);
+        }
+
+        auto res = ForcedMetrics::unflattened(doc);
+        return doc.is_flattened() ? ForcedMetrics::flattened(res) : res;
+    }
+
+    // The narrowest the text up to the first line break in `doc` can be when it's not flattened, followed by text
+    // that's `below` wide. For a `Generated` node, only its docs from `from` onwards are included.
+    static uint32_t dist(const Doc &doc, uint32_t below, size_t from = 0) {
+        auto res = ForcedMetrics::until_break(doc, from);
+        return std::min<uint32_t>(res.break_width, add_widths(res.unbroken_width, below));
+    }
+
+    // The break width of `doc` when it's not flattened, along with its unbroken width if that's narrower. Once a line
+    // break is sure to be narrower than the text without one, nothing that follows can change the break width, so
+    // only the lazy docs up to that point are built, and the other metrics are left incomplete.
+    static Metrics until_break(const Doc &doc, size_t from = 0) {
+        if (!doc.has_lazy() || doc.is_flattened()) {
+            return ForcedMetrics::of(doc);
+        }
+
+        Metrics res{0, 1, 0, 0, MAX_WIDTH};
+        switch (doc.tag()) {
+        case Doc::Tag::Concat: {
+            auto &cat = doc.cast<Concat>().docs;
+            for (auto it = cat.begin(); it != cat.end() && res.unbroken_width < res.break_width; ++it) {
+                append_metrics(res, ForcedMetrics::until_break(*it));
+            }
+            return res;
+        }
+
+        case Doc::Tag::Choice: {
+            // The flattened branch is only as wide as it is in full.
+            auto &choice = doc.cast<Choice>();
+            return choice_metrics(ForcedMetrics::of(choice.left), ForcedMetrics::until_break(choice.right));
+        }
+
+        case Doc::Tag::Nest:
+            return ForcedMetrics::until_break(doc.cast<Nest>().doc);
+
+        case Doc::Tag::Lazy: {
+            auto &lazy = *static_cast<Lazy *>(doc.data());
+            std::call_once(lazy.measured_until_break, [&lazy, &doc] {
+                lazy.forced_until_break = ForcedMetrics::until_break(doc.force());
+            });
+            return lazy.forced_until_break;
+        }
+
+        case Doc::Tag::Generated: {
+            auto &gen = doc.cast<Generated>();
+            for (size_t i = from; i < gen.size && res.unbroken_width < res.break_width; i++) {
+                append_metrics(res, ForcedMetrics::until_break(doc.generated(i)));
+            }
+            return res;
+        }
+
+        default:
+            return ForcedMetrics::cached(doc);
+        }
+    }
+
+private:
+    // The metrics of `doc` including its lazy docs, ignoring whether `doc` itself is flattened.
+    static Metrics unflattened(const Doc &doc) {
+        switch (doc.tag()) {
+        case Doc::Tag::Concat: {
+            Metrics res{0, 1, 0, 0, MAX_WIDTH};
+            for (auto &child : doc.cast<Concat>().docs) {
+                append_metrics(res, ForcedMetrics::of(child));
+            }
+            return res;
+        }
+
+        case Doc::Tag::Choice: {
+            auto &choice = doc.cast<Choice>();
+            return choice_metrics(ForcedMetrics::of(choice.left), ForcedMetrics::of(choice.right));
+        }
+
+        case Doc::Tag::Nest:
+            return ForcedMetrics::of(doc.cast<Nest>().doc);
+
+        case Doc::Tag::Lazy: {
+            auto &lazy = *static_cast<Lazy *>(doc.data());
+            std::call_once(lazy.measured, [&lazy, &doc] { lazy.forced = ForcedMetrics::of(doc.force()); });
+            return lazy.forced;
+        }
+
+        case Doc::Tag::Generated: {
+            auto &gen = doc.cast<Generated>();
+            Metrics res{0, 1, 0, 0, MAX_WIDTH};
+            for (size_t i = 0; i < gen.size; i++) {
+                append_metrics(res, ForcedMetrics::of(doc.generated(i)));
+            }
+            return res;
+        }
+
+        default:
+            return ForcedMetrics::cached(doc);
+        }
+    }
+};
+
+void Doc::init_metrics() {
+    auto &metrics = this->data()->metrics;
+    switch (this->tag()) {
+    case Tag::Choice: {
+        auto &choice = this->cast<Choice>();
+        metrics = choice_metrics(ForcedMetrics::cached(choice.left), ForcedMetrics::cached(choice.right));
+        break;
+    }
+
+    case Tag::Nest:
+        metrics = ForcedMetrics::cached(this->cast<Nest>().doc);
+        break;
+
+    default:
+        break;
+    }
+}
+
+bool Doc::counted() const {
+    return (this->value & (UNOWNED_MASK | 0x1)) == 0x1;
 }
 
-bool Doc::boxed() const {
-    return this->value & 0x1;
+void Doc::mark_unowned() {
+    this->value |= UNOWNED_MASK;
 }
 
 void Doc::increment() {
-    assert(this->boxed());
-    this->refs->fetch_add(1);
+    assert(this->counted());
+    this->data()->refs.increment();
 }
 
 bool Doc::decrement() {
-    assert(this->boxed());
-    auto count = this->refs->fetch_sub(1);
-    return count == 1;
+    assert(this->counted());
+    return this->data()->refs.decrement();
 }
 
 bool Doc::is_unique() const {
     assert(this->boxed());
-    return this->refs->load() == 1;
+    // Unowned nodes don't track their references, so they are always assumed to be shared.
+    return this->counted() && this->data()->refs.load() == 1;
 }
 
 bool Doc::is_flattened() const {
@@ -94,6 +515,10 @@ bool Doc::is_flattened() const {
 }
 
 void Doc::cleanup() {
+    if (!this->counted()) {
+        return;
+    }
+
     switch (this->tag()) {
     case Tag::Nil:
     case Tag::Line:
@@ -102,40 +527,44 @@ void Doc::cleanup() {
 
     case Tag::Text:
         if (this->decrement()) {
-            delete this->refs;
-            delete static_cast<Text *>(this->data());
+            Text::destroy(static_cast<Text *>(this->data()));
         }
         return;
 
     case Tag::Concat:
         if (this->decrement()) {
-            delete this->refs;
             delete static_cast<Concat *>(this->data());
         }
         return;
 
     case Tag::Choice:
         if (this->decrement()) {
-            delete this->refs;
             delete static_cast<Choice *>(this->data());
         }
         return;
 
     case Tag::Nest:
         if (this->decrement()) {
-            delete this->refs;
             delete static_cast<Nest *>(this->data());
         }
         return;
-    }
-}
 
-Doc::~Doc() {
-    this->cleanup();
+    case Tag::Lazy:
+        if (this->decrement()) {
+            delete static_cast<Lazy *>(this->data());
+        }
+        return;
+
+    case Tag::Generated:
+        if (this->decrement()) {
+            delete static_cast<Generated *>(this->data());
+        }
+        return;
+    }
 }
 
-Doc::Doc(const Doc &other) : refs{other.refs}, value{other.value} {
-    if (this->boxed()) {
+Doc::Doc(const Doc &other) : short_text_data{other.short_text_data}, value{other.value} {
+    if (this->counted()) {
         this->increment();
     }
 }
@@ -145,35 +574,30 @@ Doc &Doc::operator=(const Doc &other) {
         return *this;
     }
 
-    if (this->boxed()) {
+    if (this->counted()) {
         this->cleanup();
     }
 
-    this->refs = other.refs;
+    this->short_text_data = other.short_text_data;
     this->value = other.value;
 
-    if (this->boxed()) {
+    if (this->counted()) {
         this->increment();
     }
 
     return *this;
 }
 
-Doc::Doc(Doc &&other) : refs{other.refs}, value{other.value} {
-    // the tag guides the destructor, so skip clearing out the refs field by instead turning this into a Nil.
-    other.value = 0;
-}
-
 Doc &Doc::operator=(Doc &&other) {
     if (this == &other) {
         return *this;
     }
 
-    if (this->boxed()) {
+    if (this->counted()) {
         this->cleanup();
     }
 
-    this->refs = other.refs;
+    this->short_text_data = other.short_text_data;
     this->value = other.value;
 
     other.value = 0;
@@ -181,33 +605,35 @@ Doc &Doc::operator=(Doc &&other) {
     return *this;
 }
 
-// Initialization of a variant that doesn't live in the heap.
-Doc::Doc(Tag tag) : refs{nullptr}, value{static_cast<uint64_t>(tag)} {}
-
-// Initialization of a variant that lives in the heap.
-Doc::Doc(Tag tag, void *ptr) : refs{new std::atomic<int>(1)}, value{make_tagged(static_cast<uint16_t>(tag), ptr)} {
+// Initialization of a variant that lives in the heap. The refcount of `ptr` is already initialized to one, and is
+// ignored when `ptr` was allocated in `arena`.
+Doc::Doc(Tag tag, Header *ptr, DocArena *arena)
+    : short_text_data{}, value{make_tagged(static_cast<uint16_t>(tag), ptr) | (arena ? UNOWNED_MASK : 0)} {
     assert(this->boxed());
 }
 
-Doc Doc::choice(Doc left, Doc right) {
-    return Doc{Tag::Choice, new Choice{std::move(left), std::move(right)}};
+Doc Doc::constant(Tag tag, Header *node) {
+    Doc res{tag, node, nullptr};
+    res.mark_unowned();
+    res.init_metrics();
+    return res;
 }
 
-// Construct a short text node. This assumes that the string is 8 chars or less.
-Doc Doc::short_text(std::string_view text) {
-    Doc res(Tag::ShortText);
-
-    auto size = text.size();
-    assert(text.size() <= 8);
-
-    res.value |= static_cast<uint64_t>(size << TAG_MASK_BITS) & SIZE_MASK;
-    std::copy_n(text.begin(), size, res.short_text_data.begin());
+Doc Doc::choice(Doc left, Doc right) {
+    auto *arena = DocArena::current();
+    auto *node = make_node<Choice>(arena, std::move(left), std::move(right));
+    if (arena != nullptr) {
+        arena->adopt(node->left);
+        arena->adopt(node->right);
+    }
 
+    Doc res{Tag::Choice, node, arena};
+    res.init_metrics();
     return res;
 }
 
 std::string_view Doc::get_short_text() const {
-    auto size = (this->value & SIZE_MASK) >> TAG_MASK_BITS;
+    auto size = (this->value & SIZE_MASK) >> SIZE_SHIFT;
     return std::string_view{this->short_text_data.data(), size};
 }
 
@@ -217,19 +643,17 @@ bool Doc::init_short_str(std::string_view str) {
         return false;
     }
 
-    this->value = static_cast<uint64_t>(Tag::ShortText) | static_cast<uint64_t>(size << TAG_MASK_BITS);
+    this->value = static_cast<uint64_t>(Tag::ShortText) | static_cast<uint64_t>(size << SIZE_SHIFT);
     std::copy_n(str.begin(), size, this->short_text_data.begin());
 
     return true;
 }
 
-void Doc::init_string(std::string str) {
-    this->refs = new std::atomic<int>(1);
-    this->value = make_tagged(static_cast<uint16_t>(Tag::Text), new Text{std::move(str)});
+void Doc::init_string(std::string_view str) {
+    auto *arena = DocArena::current();
+    *this = Doc{Tag::Text, Text::make(arena, str), arena};
 }
 
-Doc::Doc() : Doc{Tag::Nil} {}
-
 Doc::Doc(const char *str) : Doc{} {
     auto view = std::string_view(str, strlen(str));
     if (view.empty()) {
@@ -237,7 +661,7 @@ Doc::Doc(const char *str) : Doc{} {
     }
 
     if (!this->init_short_str(view)) {
-        this->init_string(std::string(view));
+        this->init_string(view);
     }
 }
 
@@ -247,28 +671,20 @@ Doc::Doc(std::string_view str) : Doc{} {
     }
 
     if (!this->init_short_str(str)) {
-        this->init_string(std::string(str));
+        this->init_string(str);
     }
 }
 
-Doc Doc::nil() {
-    return Doc{};
-}
-
-Doc Doc::line() {
-    return Doc{Tag::Line};
-}
-
 Doc Doc::softline() {
-    return Doc::choice(Doc::c(' '), Doc::line());
+    static Choice node{Doc::c(' '), Doc::line()};
+    static const Doc softline = Doc::constant(Tag::Choice, &node);
+    return softline;
 }
 
 Doc Doc::softbreak() {
-    return Doc::choice(Doc::nil(), Doc::line());
-}
-
-Doc Doc::c(char c) {
-    return Doc::short_text(std::string_view{&c, 1});
+    static Choice node{Doc::nil(), Doc::line()};
+    static const Doc softbreak = Doc::constant(Tag::Choice, &node);
+    return softbreak;
 }
 
 Doc Doc::s(std::string str) {
@@ -279,7 +695,7 @@ Doc Doc::s(std::string str) {
     }
 
     if (!res.init_short_str(str)) {
-        res.init_string(std::move(str));
+        res.init_string(str);
     }
 
     return res;
@@ -295,7 +711,8 @@ Doc Doc::s(const char *str) {
         return Doc::short_text(std::string_view{str, len});
     }
 
-    return Doc{Tag::Text, new Text{str, len}};
+    auto *arena = DocArena::current();
+    return Doc{Tag::Text, Text::make(arena, std::string_view{str, len}), arena};
 }
 
 Doc Doc::sv(std::string_view str) {
@@ -307,7 +724,54 @@ Doc Doc::sv(std::string_view str) {
         return Doc::short_text(str);
     }
 
-    return Doc{Tag::Text, new Text{str}};
+    auto *arena = DocArena::current();
+    return Doc{Tag::Text, Text::make(arena, str), arena};
+}
+
+Doc Doc::make_concat() {
+    if (auto *arena = DocArena::current()) {
+        return Doc{Tag::Concat, make_node<Concat>(arena, arena->resource()), arena};
+    }
+    return Doc{Tag::Concat, new Concat{std::pmr::new_delete_resource()}, nullptr};
+}
+
+std::pmr::vector<Doc> &Doc::concat_docs() {
+    assert(this->tag() == Tag::Concat);
+    return this->cast<Concat>().docs;
+}
+
+std::pmr::vector<Doc> &Doc::unique_concat() {
+    if (this->tag() != Tag::Concat || !this->is_unique()) {
+        auto res = Doc::make_concat();
+        if (!this->is_nil()) {
+            res.concat_docs().emplace_back(std::move(*this));
+            res.register_children(0);
+        }
+        *this = std::move(res);
+    }
+
+    return this->concat_docs();
+}
+
+void Doc::register_children(size_t from) {
+    assert(this->tag() == Tag::Concat);
+
+    auto &cat = this->cast<Concat>();
+    for (auto it = cat.docs.begin() + from; it != cat.docs.end(); ++it) {
+        append_metrics(cat.metrics, ForcedMetrics::cached(*it));
+    }
+
+    if (this->counted()) {
+        return;
+    }
+
+    // Only the arena that owns the node can adopt its children.
+    auto *arena = DocArena::current();
+    if (arena != nullptr && arena->resource() == cat.docs.get_allocator().resource()) {
+        for (auto it = cat.docs.begin() + from; it != cat.docs.end(); ++it) {
+            arena->adopt(*it);
+        }
+    }
 }
 
 Doc Doc::operator+(Doc other) const {
@@ -326,7 +790,9 @@ Doc &Doc::append(Doc other) {
 
     case Tag::Concat:
         if (this->is_unique()) {
-            this->cast<Concat>().emplace_back(std::move(other));
+            auto &docs = this->cast<Concat>().docs;
+            docs.emplace_back(std::move(other));
+            this->register_children(docs.size() - 1);
             break;
         }
 
@@ -379,22 +845,119 @@ Doc Doc::flatten(const Doc &doc) {
 }
 
 Doc Doc::nest(int indent, Doc doc) {
-    return Doc{Tag::Nest, new Nest{std::move(doc), indent}};
+    auto *arena = DocArena::current();
+    auto *node = make_node<Nest>(arena, std::move(doc), indent);
+    if (arena != nullptr) {
+        arena->adopt(node->doc);
+    }
+
+    Doc res{Tag::Nest, node, arena};
+    res.init_metrics();
+    return res;
 }
 
-namespace {
+Doc Doc::lazy(std::function<Doc()> make) {
+    // Arena nodes that hold the doc adopt it, keeping it alive until the arena is destroyed.
+    return Doc{Tag::Lazy, new Lazy{std::move(make)}, nullptr};
+}
+
+Doc Doc::generate(size_t size, std::function<Doc(size_t)> make) {
+    if (size == 0) {
+        return Doc::nil();
+    }
+
+    // Positions within the sequence are kept in 32 bits on the work stack.
+    assert(size <= UINT32_MAX);
+    return Doc{Tag::Generated, new Generated{static_cast<uint32_t>(size), std::move(make)}, nullptr};
+}
+
+namespace detail {
 
-struct Node {
+struct RenderNode {
     const Doc *doc;
     int indent;
     bool flattening;
 
-    Node(const Doc *doc, int indent, bool flattening) : doc{doc}, indent{indent}, flattening{flattening} {}
+    // For the linear engine, the narrowest the text from the start of this node up to the next line break can be,
+    // including the nodes below it on the work stack.
+    uint32_t dist;
+
+    // For a `Generated` node, the index of the next doc to generate.
+    uint32_t from{0};
+
+    RenderNode(const Doc *doc, int indent, bool flattening, uint32_t dist)
+        : doc{doc}, indent{indent}, flattening{flattening}, dist{dist} {}
 };
 
-} // namespace
+// The docs generated by a traversal, which are released in the reverse of the order they were generated in. Their
+// addresses don't change while they're held, and their storage is kept for reuse once they're released.
+class GeneratedDocs final {
+    static constexpr size_t BLOCK_SIZE = 64;
 
-class Fits final {
+    std::vector<std::unique_ptr<std::array<Doc, BLOCK_SIZE>>> blocks;
+    size_t size{0};
+
+    Doc &slot(size_t index) {
+        return (*this->blocks[index / BLOCK_SIZE])[index % BLOCK_SIZE];
+    }
+
+public:
+    Doc &push(Doc doc) {
+        if (this->size == this->blocks.size() * BLOCK_SIZE) {
+            this->blocks.emplace_back(std::make_unique<std::array<Doc, BLOCK_SIZE>>());
+        }
+
+        auto &res = this->slot(this->size++);
+        res = std::move(doc);
+        return res;
+    }
+
+    // Release the doc generated last.
+    void pop() {
+        this->slot(--this->size) = Doc{};
+    }
+
+    void clear() {
+        while (this->size > 0) {
+            this->pop();
+        }
+    }
+
+    bool empty() const {
+        return this->size == 0;
+    }
+};
+
+} // namespace detail
+
+namespace {
+
+using Node = detail::RenderNode;
+
+} // namespace
+
+RenderContext::RenderContext() = default;
+
+RenderContext::~RenderContext() = default;
+
+std::vector<Node> &RenderContext::stack(size_t depth) {
+    // The stacks are boxed so that growing the list doesn't move the ones still in use by the enclosing checks.
+    while (this->stacks.size() <= depth) {
+        this->stacks.emplace_back(std::make_unique<std::vector<Node>>());
+    }
+
+    return *this->stacks[depth];
+}
+
+detail::GeneratedDocs &RenderContext::generated_docs(size_t depth) {
+    while (this->generated.size() <= depth) {
+        this->generated.emplace_back(std::make_unique<detail::GeneratedDocs>());
+    }
+
+    return *this->generated[depth];
+}
+
+class Fits final {
 public:
     using Iterator = std::vector<Node>::const_reverse_iterator;
 
@@ -406,18 +969,31 @@ private:
     Iterator it;
     Iterator end;
 
+    // The docs of a generated node from the renderer that haven't been taken yet, which come before the rest of its
+    // nodes.
+    std::optional<Node> rest;
+
 public:
     Fits(int width, int col, Iterator it, Iterator end) : width{width}, col{col}, it{it}, end{end} {}
 
-    int get_width() const {
-        return this->width;
-    }
-
     int get_col() const {
         return this->col;
     }
 
+    Engine get_engine() const {
+        return Engine::Fits;
+    }
+
     std::optional<Node> next() {
+        if (this->rest) {
+            return std::exchange(this->rest, std::nullopt);
+        }
+
+        // The ends of the renderer's generated docs are skipped, as they release docs that this check didn't generate.
+        while (this->it != this->end && this->it->doc == nullptr) {
+            ++this->it;
+        }
+
         if (this->it == this->end) {
             return {};
         }
@@ -432,6 +1008,12 @@ public:
         return this->col <= this->width;
     }
 
+    // Hand back the rest of a generated node taken from the renderer. Nested checks only see the nodes that this check
+    // has taken, so the docs are taken one at a time, as the docs of a `Concat` that the renderer has expanded are.
+    void put_back(Node rest) {
+        this->rest = rest;
+    }
+
     bool visit_text(std::string_view s) {
         this->col += s.size();
         return this->fits();
@@ -441,205 +1023,1520 @@ public:
         return false;
     }
 
-    static bool check(int width, int col, Iterator it, Iterator end, const Doc *doc, bool flattening);
-};
+    // Fits only tracks the current column, so nodes whose width is known ahead of time don't need to be visited.
+    static constexpr bool measuring = true;
+    static constexpr bool forking = false;
+
+    bool visit_width(uint32_t width) {
+        this->col = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(this->col) + width, MAX_WIDTH));
+        return this->fits();
+    }
+
+    template <typename Fn> bool choose(Fn &&fits) {
+        return fits(this->width);
+    }
 
-class DocRenderer {
+    static bool check(
+        RenderContext &ctx, size_t depth, int width, int col, Iterator it, Iterator end, const Doc *doc, bool flattening);
+};
 
+// Lays out the doc like `DocRenderer`, but only keeps track of the shape of the output.
+class Measure final {
     const int width;
-    Writer &out;
+    const Engine engine;
 
     int col{0};
 
-public:
-    DocRenderer(int width, Writer &out) : width{width}, out{out} {}
+    Measurement res{1, 0, 0, 0};
+
+    void end_line() {
+        this->res.max_width = std::max<size_t>(this->res.max_width, this->col);
+        if (this->col > this->width) {
+            this->res.overflowing++;
+        }
+    }
 
-    int get_width() const {
-        return this->width;
+    void advance(size_t width) {
+        this->col = static_cast<int>(std::min<size_t>(static_cast<size_t>(this->col) + width, MAX_WIDTH));
     }
 
+public:
+    Measure(int width, Engine engine) : width{width}, engine{engine} {}
+
     int get_col() const {
         return this->col;
     }
 
-    // The renderer doesn't buffer any additional nodes.
+    Engine get_engine() const {
+        return this->engine;
+    }
+
     std::optional<Node> next() {
         return {};
     }
 
     bool visit_text(std::string_view s) {
-        this->out.write(s);
-        this->col += s.size();
+        this->res.bytes += s.size();
+        this->advance(s.size());
         return true;
     }
 
     bool visit_line(int indent) {
-        this->out.line(indent);
+        this->end_line();
+        this->res.lines++;
+        this->res.bytes += 1 + indent;
         this->col = indent;
         return true;
     }
 
-    static void render(int cols, Writer &out, const Doc *doc);
+    // Text on a single line only adds to the width of the current line, so it doesn't need to be visited.
+    static constexpr bool measuring = true;
+    static constexpr bool forking = false;
+
+    bool visit_width(uint32_t width) {
+        this->res.bytes += width;
+        this->advance(width);
+        return true;
+    }
+
+    template <typename Fn> bool choose(Fn &&fits) {
+        return fits(this->width);
+    }
+
+    Measurement result() {
+        this->end_line();
+        return this->res;
+    }
 };
 
-template <typename T> class DocVisitor {
-    std::vector<Node> work{};
+// Lays the doc out at several widths at once, producing a `Measurement` for each and, when `Render` is set, the output
+// as well. The widths share one traversal for as long as they decide every choice the same way, as their output up to
+// that point is identical. When they disagree, the widths that don't fit the flattened branch are split off into a
+// fork that carries on from a copy of the work stack.
+template <bool Render> class Widths final {
+    struct Member {
+        // The index of the width in the list being laid out.
+        size_t index;
+
+        // The lines so far that don't fit in the width.
+        size_t overflowing;
+    };
 
-    T state;
+    Engine engine;
+    std::span<const int> widths;
+    std::span<Measurement> measured;
+    std::span<std::string> rendered;
 
-public:
-    DocVisitor(T &&state) : state{std::move(state)} {}
+    // The widths that share this traversal, and those that were split off by the last choice.
+    std::vector<Member> group;
+    std::vector<Member> split;
 
-    bool done();
-    Node next();
+    int col{0};
 
-    T *operator->() {
-        return &this->state;
-    }
+    Measurement res{1, 0, 0, 0};
+    std::string out;
 
-    void visit(const Doc *doc, bool flattening = false);
-};
+    void end_line() {
+        this->res.max_width = std::max<size_t>(this->res.max_width, this->col);
+        for (auto &member : this->group) {
+            if (this->col > this->widths[member.index]) {
+                member.overflowing++;
+            }
+        }
+    }
 
-template <typename T> bool DocVisitor<T>::done() {
-    if (!this->work.empty()) {
-        return false;
+    void advance(size_t width) {
+        this->col = static_cast<int>(std::min<size_t>(static_cast<size_t>(this->col) + width, MAX_WIDTH));
     }
 
-    if (auto next = this->state.next()) {
-        this->work.push_back(*next);
-        return false;
+public:
+    Widths(Engine engine, std::span<const int> widths, std::span<Measurement> measured, std::span<std::string> rendered)
+        : engine{engine}, widths{widths}, measured{measured}, rendered{rendered} {
+        for (size_t i = 0; i < widths.size(); i++) {
+            this->group.push_back(Member{i, 0});
+        }
     }
 
-    return true;
-}
+    int get_col() const {
+        return this->col;
+    }
 
-template <typename T> Node DocVisitor<T>::next() {
-    auto node = this->work.back();
-    this->work.pop_back();
+    Engine get_engine() const {
+        return this->engine;
+    }
 
-    return node;
-}
+    std::optional<Node> next() {
+        return {};
+    }
 
-template <typename T> void DocVisitor<T>::visit(const Doc *doc, bool flattening) {
-    this->work.clear();
+    bool visit_text(std::string_view s) {
+        if constexpr (Render) {
+            this->out.append(s);
+        }
+        this->res.bytes += s.size();
+        this->advance(s.size());
+        return true;
+    }
 
-    this->work.emplace_back(doc, 0, flattening || doc->is_flattened());
+    bool visit_line(int indent) {
+        this->end_line();
+        if constexpr (Render) {
+            this->out.push_back('\n');
+            this->out.append(indent, ' ');
+        }
+        this->res.lines++;
+        this->res.bytes += 1 + indent;
+        this->col = indent;
+        return true;
+    }
 
-    auto push = [this](Node &parent, const Doc *doc) -> Node & {
-        return this->work.emplace_back(doc, parent.indent, parent.flattening || doc->is_flattened());
-    };
+    // Without any output to produce, single line nodes only add to the width of the current line.
+    static constexpr bool measuring = !Render;
+    static constexpr bool forking = true;
 
-    bool running = true;
-    while (running && !this->done()) {
-        auto node = this->next();
+    bool visit_width(uint32_t width) {
+        this->res.bytes += width;
+        this->advance(width);
+        return true;
+    }
 
-        switch (node.doc->tag()) {
-        case Doc::Tag::Nil:
-            break;
+    // Keeps the widths that fit the flattened branch in this traversal, and sets aside the rest for `fork`.
+    template <typename Fn> bool choose(Fn &&fits) {
+        if (this->group.size() == 1) {
+            return fits(this->widths[this->group.front().index]);
+        }
 
-        case Doc::Tag::Line: {
-            if (node.flattening) {
-                running = this->state.visit_text(" ");
+        size_t kept = 0;
+        for (auto &member : this->group) {
+            if (fits(this->widths[member.index])) {
+                this->group[kept++] = member;
             } else {
-                running = this->state.visit_line(node.indent);
+                this->split.push_back(member);
             }
-            break;
         }
 
-        case Doc::Tag::ShortText: {
-            auto text = node.doc->get_short_text();
-            running = this->state.visit_text(text);
-            break;
+        if (kept == 0) {
+            this->group.swap(this->split);
+            this->split.clear();
+            return false;
         }
 
-        case Doc::Tag::Text: {
-            auto &text = node.doc->template cast<Text>();
-            running = this->state.visit_text(text);
-            break;
+        this->group.resize(kept);
+        return true;
+    }
+
+    // Forks only ever take the branch that didn't fit.
+    bool took_left() const {
+        return false;
+    }
+
+    // The traversal for the widths that the last choice split off, if there were any.
+    std::optional<Widths> fork() {
+        if (this->split.empty()) {
+            return {};
         }
 
-        case Doc::Tag::Concat: {
-            auto &cat = node.doc->template cast<Concat>();
-            for (auto it = cat.rbegin(); it != cat.rend(); ++it) {
-                push(node, &*it);
+        std::optional<Widths> res{*this};
+        res->group.swap(res->split);
+        res->split.clear();
+        this->split.clear();
+        return res;
+    }
+
+    // Record the results for every width in this traversal.
+    void finish() {
+        this->end_line();
+        for (auto &member : this->group) {
+            auto &res = this->measured[member.index];
+            res = this->res;
+            res.overflowing = member.overflowing;
+
+            if constexpr (Render) {
+                this->rendered[member.index] = this->out;
             }
-            break;
         }
+    }
+};
 
-        case Doc::Tag::Choice: {
-            auto &choice = node.doc->template cast<Choice>();
-            if (node.flattening) {
-                this->work.emplace_back(&choice.left, node.indent, true);
-            } else {
-                if (Fits::check(
-                        this->state.get_width(),
-                        this->state.get_col(),
-                        this->work.rbegin(),
-                        this->work.rend(),
-                        &choice.left,
-                        node.flattening)) {
-                    push(node, &choice.left);
-                } else {
-                    push(node, &choice.right);
+// Finds the spans of line lengths in a range that lay the doc out the same way, for `Layout`. A traversal covers the
+// line lengths in `[lo, hi]`, which have made the same choices so far. When they disagree on a choice, the line
+// lengths that decided differently continue in forks.
+class LayoutRanges final {
+    struct Split {
+        int lo;
+        int hi;
+        bool left;
+    };
+
+    Engine engine;
+    int lo;
+    int hi;
+
+    int col{0};
+
+    std::vector<bool> decisions;
+    std::vector<Layout::Range> *ranges;
+
+    // The line lengths split off by the last choice.
+    std::vector<Split> splits;
+
+    // Split off the line lengths in `[lo, hi]`, which decided the last choice as `left`.
+    void split(int lo, int hi, bool left) {
+        this->splits.push_back(Split{lo, hi, left});
+    }
+
+public:
+    LayoutRanges(Engine engine, int lo, int hi, std::vector<Layout::Range> &ranges)
+        : engine{engine}, lo{lo}, hi{hi}, ranges{&ranges} {}
+
+    int get_col() const {
+        return this->col;
+    }
+
+    Engine get_engine() const {
+        return this->engine;
+    }
+
+    std::optional<Node> next() {
+        return {};
+    }
+
+    bool visit_text(std::string_view s) {
+        return this->visit_width(std::min<size_t>(s.size(), MAX_WIDTH));
+    }
+
+    bool visit_line(int indent) {
+        this->col = indent;
+        return true;
+    }
+
+    // A replay reads a decision for every choice it reaches, including those within docs that fit on a line, so none
+    // of them can be skipped over.
+    static constexpr bool measuring = false;
+    static constexpr bool forking = true;
+
+    bool visit_width(uint32_t width) {
+        this->col = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(this->col) + width, MAX_WIDTH));
+        return true;
+    }
+
+    template <typename Fn> bool choose(Fn &&fits) {
+        auto res = fits(this->lo);
+
+        if (this->engine == Engine::Linear) {
+            // The flattened branch fits once the line is at least as wide as the text up to the next line break, so
+            // the line lengths split at most once, at a threshold that can be found by bisection.
+            if (!res && this->lo < this->hi && fits(this->hi)) {
+                auto no = this->lo;
+                auto yes = this->hi;
+                while (yes - no > 1) {
+                    auto mid = no + (yes - no) / 2;
+                    if (fits(mid)) {
+                        yes = mid;
+                    } else {
+                        no = mid;
+                    }
                 }
+
+                this->split(this->lo, no, false);
+                this->lo = yes;
+                res = true;
+            }
+        } else {
+            // The lookahead of `Fits` decides the choices that follow greedily, so whether the flattened branch fits
+            // can change back and forth as the line gets wider, and every line length has to be checked. This
+            // traversal keeps the first run of line lengths that agree.
+            auto end = this->lo;
+            while (end < this->hi && fits(end + 1) == res) {
+                end++;
             }
-            break;
-        }
 
-        case Doc::Tag::Nest: {
-            auto &nest = node.doc->template cast<Nest>();
-            auto &next = push(node, &nest.doc);
-            next.indent += nest.indent;
-            break;
-        }
+            auto start = end + 1;
+            while (start <= this->hi) {
+                auto left = fits(start);
+                auto stop = start;
+                while (stop < this->hi && fits(stop + 1) == left) {
+                    stop++;
+                }
+
+                this->split(start, stop, left);
+                start = stop + 1;
+            }
+
+            this->hi = end;
         }
+
+        this->decisions.push_back(res);
+        return res;
     }
-}
 
-bool Fits::check(int width, int col, Iterator it, Iterator end, const Doc *doc, bool flattening) {
-    DocVisitor<Fits> checker{Fits{width, col, it, end}};
-    checker.visit(doc, flattening);
-    return checker->fits();
-}
+    // The branch taken by a fork.
+    bool took_left() const {
+        return this->decisions.back();
+    }
 
-void DocRenderer::render(int cols, Writer &out, const Doc *doc) {
-    DocVisitor<DocRenderer> renderer{DocRenderer{cols, out}};
-    renderer.visit(doc);
-}
+    // A traversal for one of the runs of line lengths split off by the last choice, until there are none left.
+    std::optional<LayoutRanges> fork() {
+        if (this->splits.empty()) {
+            return {};
+        }
 
-StreamWriter::StreamWriter(std::ostream &out) : out{out} {}
+        auto split = this->splits.back();
+        this->splits.pop_back();
 
-void StreamWriter::line(int indent) {
-    this->out << std::endl;
+        std::optional<LayoutRanges> res{*this};
+        res->lo = split.lo;
+        res->hi = split.hi;
+        res->decisions.back() = split.left;
+        res->splits.clear();
+        return res;
+    }
 
-    for (int i = 0; i < indent; i++) {
-        this->out.put(' ');
+    void finish() {
+        this->ranges->push_back(Layout::Range{this->lo, this->hi, std::move(this->decisions)});
     }
-}
+};
 
-void StreamWriter::write(std::string_view sv) {
-    this->out << sv;
-}
+// What to do with the decisions made for each choice during a render.
+enum class Decisions {
+    // Decide each choice as it's reached.
+    Decide,
 
-StringWriter::StringWriter() : buffer{} {}
+    // Decide each choice, and record the decisions.
+    Record,
 
-void StringWriter::line(int indent) {
-    this->buffer.push_back('\n');
-    this->buffer.append(indent, ' ');
-}
+    // Take the decisions recorded by an earlier render of the same doc, at the same width.
+    Replay,
+};
 
-void StringWriter::write(std::string_view sv) {
-    this->buffer.append(sv);
-}
+template <typename W> class DocRenderer {
+
+    const int width;
+    const Engine engine;
+    W &out;
 
-void Doc::render(Writer &out, int cols) const {
-    DocRenderer::render(cols, out, this);
+    int col{0};
+
+    const Decisions decisions;
+
+    // Where decisions are appended to when recording, or taken from when replaying.
+    std::vector<bool> *recording{nullptr};
+    const std::vector<bool> *replaying{nullptr};
+    size_t replayed{0};
+
+public:
+    DocRenderer(int width, Engine engine, W &out) : width{width}, engine{engine}, out{out}, decisions{Decisions::Decide} {}
+
+    DocRenderer(int width, Engine engine, W &out, std::vector<bool> &recording)
+        : width{width}, engine{engine}, out{out}, decisions{Decisions::Record}, recording{&recording} {}
+
+    DocRenderer(int width, W &out, const std::vector<bool> &replaying)
+        : width{width}, engine{Engine::Fits}, out{out}, decisions{Decisions::Replay}, replaying{&replaying} {}
+
+    int get_col() const {
+        return this->col;
+    }
+
+    Engine get_engine() const {
+        return this->engine;
+    }
+
+    // The renderer doesn't buffer any additional nodes.
+    std::optional<Node> next() {
+        return {};
+    }
+
+    bool visit_text(std::string_view s) {
+        this->out.write(s);
+        this->col += s.size();
+        return this->more();
+    }
+
+    bool visit_line(int indent) {
+        this->out.line(indent);
+        this->col = indent;
+        return this->more();
+    }
+
+    static constexpr bool measuring = false;
+    static constexpr bool forking = false;
+
+    // Generated docs are about to be released, so the writer mustn't refer to their text any more.
+    void release() {
+        if constexpr (requires(W &w) { w.detach(); }) {
+            this->out.detach();
+        }
+    }
+
+    // Writers into fixed size buffers stop the traversal once they run out of space, and writers that hand out output
+    // a chunk at a time pause it once a chunk is full.
+    bool more() const {
+        if constexpr (requires(const W &w) { w.truncated(); }) {
+            return !this->out.truncated();
+        } else if constexpr (requires(const W &w) { w.full(); }) {
+            return !this->out.full();
+        } else {
+            return true;
+        }
+    }
+
+    // Decide whether to take the flattened branch of a choice, where `fits` measures it at a given width.
+    template <typename Fn> bool choose(Fn &&fits) {
+        switch (this->decisions) {
+        case Decisions::Decide:
+            return fits(this->width);
+
+        case Decisions::Record: {
+            auto res = fits(this->width);
+            this->recording->push_back(res);
+            return res;
+        }
+
+        case Decisions::Replay:
+            return (*this->replaying)[this->replayed++];
+        }
+
+        return false;
+    }
+
+    static void render(RenderContext &ctx, int cols, Engine engine, W &out, const Doc *doc);
+
+    // Render, recording the decisions made for every choice in `ctx`.
+    static void record(RenderContext &ctx, int cols, Engine engine, W &out, const Doc *doc);
+
+    // Render taking the choices in `decisions`, which were recorded for the same doc and width.
+    static void replay(RenderContext &ctx, int cols, W &out, const Doc *doc, const std::vector<bool> &decisions);
+};
+
+template <typename T> class DocVisitor {
+    RenderContext &ctx;
+
+    // How many `Fits` checks this visitor is nested within.
+    const size_t depth;
+
+    std::vector<Node> &work;
+
+    // The generated docs that nodes on the work stack refer to.
+    detail::GeneratedDocs &generated;
+
+    T state;
+
+    // For states that lay the doc out at several widths, the traversals that split off from this one, and still need
+    // to be run.
+    struct Fork {
+        std::vector<Node> work;
+        T state;
+    };
+    std::vector<Fork> forks;
+
+    // The work stack at which the traversal stops, listed from the bottom, if any.
+    std::span<const std::pair<const Doc *, int>> until;
+
+    bool stopped() const;
+    void run();
+
+    // Let the state know that generated docs are about to be released.
+    void release();
+
+public:
+    DocVisitor(RenderContext &ctx, size_t depth, T &&state)
+        : ctx{ctx}, depth{depth}, work{ctx.stack(depth)}, generated{ctx.generated_docs(depth)}, state{std::move(state)} {}
+
+    bool done();
+    Node next();
+
+    uint32_t dist(const Doc *doc, bool flattening) const;
+    Node &push(const Doc *doc, int indent, bool flattening);
+    bool fits(const Doc *left, int width);
+
+    // Push `doc`, the next doc generated by the `Generated` node `node`, along with the marker that releases it.
+    void generate(const Node &node, Doc doc);
+
+    T *operator->() {
+        return &this->state;
+    }
+
+    void visit(const Doc *doc, bool flattening = false);
+
+    // Visit from the work stack `work`, listed from the bottom, each doc at its own indentation. The traversal stops
+    // once the work stack matches `until`, or there's nothing left to visit.
+    void visit(std::span<const std::pair<const Doc *, int>> work, std::span<const std::pair<const Doc *, int>> until);
+
+    // Start a traversal of `doc` that's carried out by calls to `resume`, for states that pause it part way through.
+    void start(const Doc *doc);
+
+    // Carry on with the traversal until the state pauses it. Returns false once there's nothing left to visit.
+    bool resume();
+};
+
+template <typename T> void DocVisitor<T>::release() {
+    if constexpr (requires(T &state) { state.release(); }) {
+        if (!this->generated.empty()) {
+            this->state.release();
+        }
+    }
+}
+
+// The work stack only depends on the docs visited so far, so a traversal that reaches a stack it's given has visited
+// exactly the docs before it. The stacks are compared from the top, where they're most likely to differ.
+template <typename T> bool DocVisitor<T>::stopped() const {
+    if (this->until.empty() || this->work.size() != this->until.size()) {
+        return false;
+    }
+
+    return std::equal(this->work.rbegin(), this->work.rend(), this->until.rbegin(), [](const Node &node, auto &doc) {
+        return node.doc == doc.first && node.indent == doc.second && node.from == 0;
+    });
+}
+
+template <typename T> bool DocVisitor<T>::done() {
+    if (!this->work.empty()) {
+        return this->stopped();
+    }
+
+    if (auto next = this->state.next()) {
+        // A generated node that's been started stands for the docs that are left of it, as separate nodes. Those are
+        // taken one at a time, while one that hasn't been started is taken whole, as a `Concat` would be.
+        if constexpr (requires(T &state) { state.put_back(*next); }) {
+            if (next->doc->tag() == Doc::Tag::Generated && next->from > 0) {
+                auto &gen = next->doc->template cast<Generated>();
+                if (next->from + 1 < gen.size) {
+                    auto rest = *next;
+                    rest.from++;
+                    this->state.put_back(rest);
+                }
+                this->generate(*next, next->doc->generated(next->from));
+                return false;
+            }
+        }
+
+        this->work.push_back(*next);
+        return false;
+    }
+
+    return true;
+}
+
+template <typename T> Node DocVisitor<T>::next() {
+    auto node = this->work.back();
+    this->work.pop_back();
+
+    return node;
+}
+
+// The linear engine tracks the distance to the next line break for every node on the work stack. As the nodes below
+// a node don't change while it's on the stack, that distance can be computed once, when it's pushed.
+template <typename T> uint32_t DocVisitor<T>::dist(const Doc *doc, bool flattening) const {
+    if (this->state.get_engine() != Engine::Linear) {
+        return 0;
+    }
+
+    auto below = this->work.empty() ? 0 : this->work.back().dist;
+    if (flattening) {
+        return add_widths(ForcedMetrics::of(*doc).flat_width, below);
+    }
+
+    return ForcedMetrics::dist(*doc, below);
+}
+
+template <typename T> Node &DocVisitor<T>::push(const Doc *doc, int indent, bool flattening) {
+    flattening = flattening || doc->is_flattened();
+    return this->work.emplace_back(doc, indent, flattening, this->dist(doc, flattening));
+}
+
+// Decide whether or not the flattened `left` branch of a choice fits, given the nodes that follow it.
+template <typename T> bool DocVisitor<T>::fits(const Doc *left, int width) {
+    auto col = this->state.get_col();
+
+    if (this->state.get_engine() == Engine::Linear) {
+        auto rest = this->work.empty() ? 0 : this->work.back().dist;
+        return static_cast<int64_t>(col) + add_widths(ForcedMetrics::of(*left).flat_width, rest) <= width;
+    }
+
+    return Fits::check(this->ctx, this->depth + 1, width, col, this->work.rbegin(), this->work.rend(), left, false);
+}
+
+template <typename T> void DocVisitor<T>::generate(const Node &node, Doc doc) {
+    auto &held = this->generated.push(std::move(doc));
+
+    auto below = this->work.empty() ? 0 : this->work.back().dist;
+    this->work.emplace_back(nullptr, 0, false, below);
+    this->push(&held, node.indent, node.flattening);
+}
+
+template <typename T> void DocVisitor<T>::visit(const Doc *doc, bool flattening) {
+    this->work.clear();
+
+    this->push(doc, 0, flattening);
+    this->run();
+
+    if constexpr (T::forking) {
+        this->state.finish();
+
+        while (!this->forks.empty()) {
+            auto fork = std::move(this->forks.back());
+            this->forks.pop_back();
+
+            this->work = std::move(fork.work);
+            this->state = std::move(fork.state);
+            this->run();
+            this->state.finish();
+        }
+    }
+
+    // A traversal that stopped early leaves generated docs behind, which mustn't outlive the render.
+    this->release();
+    this->generated.clear();
+}
+
+template <typename T>
+void DocVisitor<T>::visit(
+    std::span<const std::pair<const Doc *, int>> work, std::span<const std::pair<const Doc *, int>> until) {
+    this->work.clear();
+    this->until = until;
+
+    for (auto [doc, indent] : work) {
+        this->push(doc, indent, false);
+    }
+    this->run();
+    this->release();
+    this->generated.clear();
+    this->until = {};
+}
+
+template <typename T> void DocVisitor<T>::start(const Doc *doc) {
+    static_assert(!T::forking);
+
+    this->work.clear();
+    this->push(doc, 0, false);
+}
+
+// The work stack holds everything that's left to visit, so the traversal can pick up where it was paused.
+template <typename T> bool DocVisitor<T>::resume() {
+    this->run();
+    return !this->work.empty();
+}
+
+template <typename T> void DocVisitor<T>::run() {
+    auto push = [this](Node &parent, const Doc *doc) -> Node & {
+        return this->push(doc, parent.indent, parent.flattening);
+    };
+
+    bool running = true;
+    while (running && !this->done()) {
+        auto node = this->next();
+
+        // The end of a generated doc, which is released unless a fork still refers to it.
+        if (node.doc == nullptr) {
+            if constexpr (!T::forking) {
+                this->release();
+                this->generated.pop();
+            }
+            continue;
+        }
+
+        if constexpr (T::measuring) {
+            // The cached width of a node leaves out its lazy docs, so those nodes are visited.
+            if (node.doc->single_line() || (node.flattening && !node.doc->has_lazy())) {
+                running = this->state.visit_width(node.doc->flat_width());
+                continue;
+            }
+        }
+
+        switch (node.doc->tag()) {
+        case Doc::Tag::Nil:
+            break;
+
+        case Doc::Tag::Line: {
+            if (node.flattening) {
+                running = this->state.visit_text(" ");
+            } else {
+                running = this->state.visit_line(node.indent);
+            }
+            break;
+        }
+
+        case Doc::Tag::ShortText: {
+            auto text = node.doc->get_short_text();
+            running = this->state.visit_text(text);
+            break;
+        }
+
+        case Doc::Tag::Text: {
+            auto &text = node.doc->template cast<Text>();
+            running = this->state.visit_text(text.view());
+            break;
+        }
+
+        case Doc::Tag::Concat: {
+            auto &cat = node.doc->template cast<Concat>().docs;
+            for (auto it = cat.rbegin(); it != cat.rend(); ++it) {
+                push(node, &*it);
+            }
+            break;
+        }
+
+        case Doc::Tag::Choice: {
+            auto &choice = node.doc->template cast<Choice>();
+            if (node.flattening) {
+                this->push(&choice.left, node.indent, true);
+                break;
+            }
+
+            auto left = this->state.choose([this, &choice](int width) { return this->fits(&choice.left, width); });
+
+            if constexpr (T::forking) {
+                // The widths that decided differently continue from copies of the work stack.
+                while (auto rest = this->state.fork()) {
+                    auto *branch = rest->took_left() ? &choice.left : &choice.right;
+                    auto &fork = this->forks.emplace_back(this->work, std::move(*rest));
+                    auto flattening = node.flattening || branch->is_flattened();
+                    fork.work.emplace_back(branch, node.indent, flattening, this->dist(branch, flattening));
+                }
+            }
+
+            push(node, left ? &choice.left : &choice.right);
+            break;
+        }
+
+        case Doc::Tag::Nest: {
+            auto &nest = node.doc->template cast<Nest>();
+            auto &next = push(node, &nest.doc);
+            next.indent += nest.indent;
+            break;
+        }
+
+        case Doc::Tag::Lazy:
+            push(node, &node.doc->force());
+            break;
+
+        case Doc::Tag::Generated: {
+            auto &gen = node.doc->template cast<Generated>();
+            auto doc = node.doc->generated(node.from);
+
+            if (node.from + 1 < gen.size) {
+                auto &rest = this->work.emplace_back(node);
+                rest.from++;
+
+                if (this->state.get_engine() == Engine::Linear) {
+                    // When the doc that was split off can't break, the rest is only narrower by its width, unless that
+                    // saturated. Otherwise the rest is measured up to its next line break.
+                    auto metrics = node.flattening ? ForcedMetrics::of(doc) : ForcedMetrics::until_break(doc);
+                    if (node.flattening || metrics.break_width == MAX_WIDTH) {
+                        auto width = node.flattening ? metrics.flat_width : metrics.unbroken_width;
+                        rest.dist = node.dist == MAX_WIDTH ? MAX_WIDTH : node.dist - width;
+                    } else {
+                        auto below = this->work.size() > 1 ? this->work.end()[-2].dist : 0;
+                        rest.dist = ForcedMetrics::dist(*node.doc, below, rest.from);
+                    }
+                }
+            }
+
+            this->generate(node, std::move(doc));
+            break;
+        }
+        }
+    }
+}
+
+bool Fits::check(
+    RenderContext &ctx, size_t depth, int width, int col, Iterator it, Iterator end, const Doc *doc, bool flattening) {
+    DocVisitor<Fits> checker{ctx, depth, Fits{width, col, it, end}};
+    checker.visit(doc, flattening);
+    return checker->fits();
+}
+
+template <typename W> void DocRenderer<W>::render(RenderContext &ctx, int cols, Engine engine, W &out, const Doc *doc) {
+    DocVisitor<DocRenderer> renderer{ctx, 0, DocRenderer{cols, engine, out}};
+    renderer.visit(doc);
+    out.flush();
+}
+
+template <typename W> void DocRenderer<W>::record(RenderContext &ctx, int cols, Engine engine, W &out, const Doc *doc) {
+    ctx.decisions.clear();
+    DocVisitor<DocRenderer> renderer{ctx, 0, DocRenderer{cols, engine, out, ctx.decisions}};
+    renderer.visit(doc);
+    out.flush();
+}
+
+// No choice is decided while replaying, so the renderer runs as the `Fits` engine to skip the bookkeeping that
+// `Linear` does for every node.
+template <typename W>
+void DocRenderer<W>::replay(
+    RenderContext &ctx, int cols, W &out, const Doc *doc, const std::vector<bool> &decisions) {
+    DocVisitor<DocRenderer> renderer{ctx, 0, DocRenderer{cols, out, decisions}};
+    renderer.visit(doc);
+    out.flush();
+}
+
+StreamWriter::StreamWriter(std::ostream &out, Flush mode) : out{out}, mode{mode} {}
+
+namespace {
+
+// Indentation is written from this buffer, a chunk at a time.
+constexpr std::string_view SPACES{"                                                                "};
+
+} // namespace
+
+void StreamWriter::line(int indent) {
+    this->write("\n");
+
+    if (this->mode == Flush::Line) {
+        this->out.flush();
+    }
+
+    while (indent > 0) {
+        auto chunk = std::min<size_t>(indent, SPACES.size());
+        this->write(SPACES.substr(0, chunk));
+        indent -= chunk;
+    }
+}
+
+// Writes go straight to the stream buffer, skipping the sentry and formatting that `operator<<` performs for every
+// call.
+void StreamWriter::write(std::string_view sv) {
+    auto *buf = this->out.rdbuf();
+    if (buf == nullptr || buf->sputn(sv.data(), sv.size()) != static_cast<std::streamsize>(sv.size())) {
+        this->out.setstate(std::ios_base::badbit);
+    }
+}
+
+void StreamWriter::flush() {
+    this->out.flush();
+}
+
+StringWriter::StringWriter() : buffer{} {}
+
+void StringWriter::line(int indent) {
+    this->buffer.push_back('\n');
+    this->buffer.append(indent, ' ');
+}
+
+void StringWriter::write(std::string_view sv) {
+    this->buffer.append(sv);
+}
+
+void Doc::render(Writer &out, int cols, Engine engine) const {
+    RenderContext ctx;
+    this->render(ctx, out, cols, engine);
+}
+
+void Doc::render(RenderContext &ctx, Writer &out, int cols, Engine engine) const {
+    DocRenderer<Writer>::render(ctx, cols, engine, out, this);
+}
+
+template <ConcreteWriter W> void Doc::render(W &out, int cols, Engine engine) const {
+    RenderContext ctx;
+    this->render(ctx, out, cols, engine);
+}
+
+template <ConcreteWriter W> void Doc::render(RenderContext &ctx, W &out, int cols, Engine engine) const {
+    DocRenderer<W>::render(ctx, cols, engine, out, this);
+}
+
+template void Doc::render(StringWriter &, int, Engine) const;
+template void Doc::render(RenderContext &, StringWriter &, int, Engine) const;
+template void Doc::render(StreamWriter &, int, Engine) const;
+template void Doc::render(RenderContext &, StreamWriter &, int, Engine) const;
+template void Doc::render(FdWriter &, int, Engine) const;
+template void Doc::render(RenderContext &, FdWriter &, int, Engine) const;
+template void Doc::render(MmapWriter &, int, Engine) const;
+template void Doc::render(RenderContext &, MmapWriter &, int, Engine) const;
+template void Doc::render(AsyncWriter &, int, Engine) const;
+template void Doc::render(RenderContext &, AsyncWriter &, int, Engine) const;
+
+namespace {
+
+// Renders on a thread share a single context. Only building a lazy or generated doc can start a render within another,
+// and `Doc::set_aside` sets the context's stacks aside while it does.
+RenderContext &thread_context() {
+    thread_local RenderContext ctx;
+    return ctx;
+}
+
+// Writes into a fixed size buffer, dropping everything past its end.
+class SpanWriter final {
+    std::span<char> buf;
+    size_t size{0};
+    bool cut{false};
+
+public:
+    explicit SpanWriter(std::span<char> buf) : buf{buf} {}
+
+    void write(std::string_view sv) {
+        auto n = std::min(sv.size(), this->buf.size() - this->size);
+        std::copy_n(sv.data(), n, this->buf.data() + this->size);
+        this->size += n;
+        this->cut = this->cut || n < sv.size();
+    }
+
+    void line(int indent) {
+        this->write("\n");
+        auto n = std::min<size_t>(indent, this->buf.size() - this->size);
+        std::fill_n(this->buf.data() + this->size, n, ' ');
+        this->size += n;
+        this->cut = this->cut || n < static_cast<size_t>(indent);
+    }
+
+    void flush() {}
+
+    bool truncated() const {
+        return this->cut;
+    }
+
+    RenderedSpan result() const {
+        return RenderedSpan{this->size, this->cut};
+    }
+};
+
+// Collects output for `ChunkedRenderer`, pausing the render once a chunk is full.
+class ChunkWriter final {
+public:
+    std::string buffer;
+    size_t chunk_size;
+
+    explicit ChunkWriter(size_t chunk_size) : chunk_size{std::max<size_t>(chunk_size, 1)} {
+        this->buffer.reserve(this->chunk_size);
+    }
+
+    void write(std::string_view sv) {
+        this->buffer.append(sv);
+    }
+
+    void line(int indent) {
+        this->buffer.push_back('\n');
+        this->buffer.append(indent, ' ');
+    }
+
+    void flush() {}
+
+    bool full() const {
+        return this->buffer.size() >= this->chunk_size;
+    }
+};
+
+// Collects the output of some of the segments of `render_parallel`, keeping the line breaks apart from the text so
+// that they're passed on to the target writer as line breaks.
+class SegmentWriter final {
+public:
+    std::string text;
+
+    // The offset into the text of each line break, with its indentation.
+    std::vector<std::pair<size_t, int>> lines;
+
+    void write(std::string_view sv) {
+        this->text.append(sv);
+    }
+
+    void line(int indent) {
+        this->lines.emplace_back(this->text.size(), indent);
+    }
+
+    void flush() {}
+
+    void replay(Writer &out) const {
+        size_t start = 0;
+        for (auto [offset, indent] : this->lines) {
+            if (offset > start) {
+                out.write(std::string_view{this->text}.substr(start, offset - start));
+            }
+            out.line(indent);
+            start = offset;
+        }
+        if (start < this->text.size()) {
+            out.write(std::string_view{this->text}.substr(start));
+        }
+    }
+};
+
+// Counts the bytes that would be written, without writing them anywhere.
+class ByteCounter final {
+public:
+    size_t size{0};
+
+    void write(std::string_view sv) {
+        this->size += sv.size();
+    }
+
+    void line(int indent) {
+        this->size += 1 + indent;
+    }
+
+    void flush() {}
+};
+
+} // namespace
+
+// Docs are built by user code while renders are part way through, and that code may render docs of its own. The
+// render in progress on this thread sets its stacks aside while it does, which are boxed, so that its references to
+// them stay valid.
+template <typename Fn> void Doc::set_aside(Fn &&fn) {
+    auto &ctx = thread_context();
+    auto stacks = std::exchange(ctx.stacks, {});
+    auto generated = std::exchange(ctx.generated, {});
+    auto decisions = std::exchange(ctx.decisions, {});
+
+    fn();
+
+    ctx.stacks = std::move(stacks);
+    ctx.generated = std::move(generated);
+    ctx.decisions = std::move(decisions);
+}
+
+const Doc &Doc::force() const {
+    // Building the doc only fills in the node, leaving the doc that refers to it unchanged.
+    auto &lazy = *static_cast<Lazy *>(this->data());
+    std::call_once(lazy.built, [&lazy] {
+        // The doc outlives whichever arena is current, so it's built in the heap.
+        auto *arena = DocArena::exchange_current(nullptr);
+        Doc::set_aside([&lazy] { lazy.doc = std::exchange(lazy.make, nullptr)(); });
+        DocArena::exchange_current(arena);
+    });
+    return lazy.doc;
+}
+
+Doc Doc::generated(size_t index) const {
+    Doc res;
+    Doc::set_aside([this, &res, index] { res = this->cast<Generated>().make(index); });
+    return res;
+}
+
+std::string Doc::pretty(int cols, Engine engine) const {
+    // Layout is deterministic, so a measuring pass gives the exact size of the output and the string only needs to be
+    // allocated once. The measuring pass records its decisions, so that the second pass doesn't repeat the work of
+    // deciding each choice.
+    auto &ctx = thread_context();
+    ByteCounter counter;
+    DocRenderer<ByteCounter>::record(ctx, cols, engine, counter, this);
+
+    StringWriter out;
+    out.buffer.reserve(counter.size);
+    DocRenderer<StringWriter>::replay(ctx, cols, out, this, ctx.decisions);
+    return std::move(out.buffer);
+}
+
+Measurement Doc::measure(int cols, Engine engine) const {
+    DocVisitor<Measure> measure{thread_context(), 0, Measure{cols, engine}};
+    measure.visit(this);
+    return measure->result();
+}
+
+std::vector<Measurement> Doc::measure(std::span<const int> widths, Engine engine) const {
+    std::vector<Measurement> res(widths.size());
+    DocVisitor<Widths<false>> measure{thread_context(), 0, Widths<false>{engine, widths, res, {}}};
+    measure.visit(this);
+    return res;
+}
+
+std::vector<std::string> Doc::pretty(std::span<const int> widths, Engine engine) const {
+    std::vector<Measurement> measured(widths.size());
+    std::vector<std::string> res(widths.size());
+    DocVisitor<Widths<true>> renderer{thread_context(), 0, Widths<true>{engine, widths, measured, res}};
+    renderer.visit(this);
+    return res;
+}
+
+std::optional<int> Doc::min_width(size_t lines, Engine engine) const {
+    // The doc fits at a line length when it takes few enough lines, none of which overflow.
+    auto fits = [this, lines, engine](int cols) {
+        auto measured = this->measure(cols, engine);
+        return measured.lines <= lines && measured.overflowing == 0;
+    };
+
+    // Once the line is as wide as the whole doc flattened, every choice takes its flattened branch, and no line can be
+    // wider. The cached width leaves out lazy docs, so those are built to find it.
+    int lo = 0;
+    int hi = static_cast<int>(ForcedMetrics::of(*this).flat_width);
+    if (!fits(hi)) {
+        return {};
+    }
+
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+        if (fits(mid)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return hi;
+}
+
+void Doc::render_parallel(Writer &out, int cols, size_t threads, Engine engine) const {
+    // The layout that follows a line break at the top level, reached through concatenation and nesting, doesn't depend
+    // on anything before it, so the doc splits into segments that each start with one of those line breaks, and can be
+    // rendered independently. This walks the top level with the same work stack a render has, and each segment starts
+    // from the part of the stack that's visited before the next line break. That part takes in the docs that follow
+    // the segment up to that line break, which the `Fits` checks within the segment look through as a render would.
+    struct Segment {
+        // The work stack the segment starts from, and the one it stops at, in `stacks`.
+        size_t work;
+        size_t until;
+        size_t end;
+    };
+
+    std::vector<std::pair<const Doc *, int>> stacks;
+    std::vector<Segment> segments;
+
+    // The docs of the stack the current segment started from, as they're taken off it. Everything above `mark` was
+    // pushed during the segment.
+    std::vector<std::pair<const Doc *, int>> taken;
+    std::vector<std::pair<const Doc *, int>> work{{this, 0}};
+    size_t mark = work.size();
+    bool started = false;
+
+    while (!work.empty()) {
+        auto [doc, indent] = work.back();
+        if (doc->tag() == Tag::Line && !doc->is_flattened() && started) {
+            // The segment stops at the part of the stack that's left of the one it started from.
+            auto &segment = segments.emplace_back(Segment{stacks.size(), 0, 0});
+            stacks.insert(stacks.end(), taken.rbegin(), taken.rend());
+            segment.until = stacks.size();
+            stacks.insert(stacks.end(), work.begin() + mark, work.end());
+            segment.end = stacks.size();
+
+            taken.clear();
+            mark = work.size();
+            started = false;
+        }
+
+        work.pop_back();
+        if (work.size() < mark) {
+            taken.emplace_back(doc, indent);
+            mark = work.size();
+        }
+
+        if (doc->is_flattened()) {
+            started = true;
+            continue;
+        }
+
+        switch (doc->tag()) {
+        case Tag::Concat: {
+            auto &cat = doc->cast<Concat>().docs;
+            for (auto it = cat.rbegin(); it != cat.rend(); ++it) {
+                work.emplace_back(&*it, indent);
+            }
+            break;
+        }
+
+        case Tag::Nest: {
+            auto &nest = doc->cast<Nest>();
+            work.emplace_back(&nest.doc, indent + nest.indent);
+            break;
+        }
+
+        default:
+            started = true;
+            break;
+        }
+    }
+
+    auto &last = segments.emplace_back(Segment{stacks.size(), 0, 0});
+    stacks.insert(stacks.end(), taken.rbegin(), taken.rend());
+    last.until = last.end = stacks.size();
+
+    if (threads <= 1 || segments.size() <= 1) {
+        RenderContext ctx;
+        this->render(ctx, out, cols, engine);
+        return;
+    }
+
+    auto chunk_size = std::max<size_t>(1, segments.size() / (threads * detail::RUNS_PER_THREAD));
+    auto chunks = (segments.size() + chunk_size - 1) / chunk_size;
+
+    std::vector<SegmentWriter> rendered(chunks);
+    detail::run_parallel(chunks, threads, [&](size_t i) {
+        auto &ctx = thread_context();
+        auto span = std::span{stacks};
+        auto end = std::min(segments.size(), (i + 1) * chunk_size);
+        for (auto j = i * chunk_size; j < end; j++) {
+            auto &segment = segments[j];
+            DocVisitor<DocRenderer<SegmentWriter>> renderer{
+                ctx, 0, DocRenderer<SegmentWriter>{cols, engine, rendered[i]}};
+            renderer.visit(
+                span.subspan(segment.work, segment.until - segment.work),
+                span.subspan(segment.until, segment.end - segment.until));
+        }
+    });
+
+    for (auto &chunk : rendered) {
+        chunk.replay(out);
+    }
+    out.flush();
+}
+
+std::string Doc::pretty_parallel(int cols, size_t threads, Engine engine) const {
+    StringWriter out;
+    this->render_parallel(out, cols, threads, engine);
+    return std::move(out.buffer);
+}
+
+namespace {
+
+// The threads that help with `run_parallel`, which are kept for the life of the process so that the render context of
+// each one is reused from call to call. Callers always work on their own runs, and only wait for the threads that
+// joined in, so calls from several threads at once, or from within a run, make progress even when every thread in the
+// pool is busy.
+class WorkerPool final {
+    struct Job {
+        const std::function<void(size_t)> *run;
+        size_t runs;
+        std::atomic<size_t> next{0};
+
+        // How many more threads may join in, and how many of those that did are still working.
+        size_t wanted;
+        size_t active;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    // The jobs that threads can still join.
+    std::vector<Job *> jobs;
+    std::vector<std::thread> workers;
+    bool stopping{false};
+
+    static void work(Job &job) {
+        for (auto i = job.next++; i < job.runs; i = job.next++) {
+            (*job.run)(i);
+        }
+    }
+
+    void work() {
+        std::unique_lock lock{this->mutex};
+        while (true) {
+            this->wake.wait(lock, [this] { return this->stopping || !this->jobs.empty(); });
+            if (this->stopping) {
+                return;
+            }
+
+            auto &job = *this->jobs.back();
+            job.active++;
+            if (--job.wanted == 0) {
+                this->jobs.pop_back();
+            }
+
+            lock.unlock();
+            WorkerPool::work(job);
+            lock.lock();
+
+            if (--job.active == 0) {
+                this->finished.notify_all();
+            }
+        }
+    }
+
+public:
+    ~WorkerPool() {
+        {
+            std::lock_guard lock{this->mutex};
+            this->stopping = true;
+        }
+        this->wake.notify_all();
+        for (auto &worker : this->workers) {
+            worker.join();
+        }
+    }
+
+    void run(size_t runs, size_t threads, const std::function<void(size_t)> &run) {
+        auto helpers = std::min(threads, runs);
+        helpers = helpers > 0 ? helpers - 1 : 0;
+
+        Job job{&run, runs, 0, helpers, 0};
+        if (helpers == 0) {
+            WorkerPool::work(job);
+            return;
+        }
+
+        {
+            std::lock_guard lock{this->mutex};
+            while (this->workers.size() < helpers) {
+                this->workers.emplace_back([this] { this->work(); });
+            }
+            this->jobs.push_back(&job);
+        }
+        for (size_t i = 0; i < helpers; i++) {
+            this->wake.notify_one();
+        }
+
+        WorkerPool::work(job);
+
+        std::unique_lock lock{this->mutex};
+        // Threads that haven't joined in yet would find nothing left to do.
+        if (auto it = std::find(this->jobs.begin(), this->jobs.end(), &job); it != this->jobs.end()) {
+            this->jobs.erase(it);
+        }
+        this->finished.wait(lock, [&job] { return job.active == 0; });
+    }
+};
+
+} // namespace
+
+namespace detail {
+
+void run_parallel(size_t runs, size_t threads, const std::function<void(size_t)> &run) {
+    static WorkerPool pool;
+    pool.run(runs, threads, run);
+}
+
+} // namespace detail
+
+RenderedBatch render_batch(std::span<const Doc> docs, int cols, size_t threads, Engine engine) {
+    RenderedBatch res;
+    res.offsets.resize(docs.size() + 1);
+
+    auto run_size = std::max<size_t>(1, docs.size() / (std::max<size_t>(threads, 1) * detail::RUNS_PER_THREAD));
+    auto runs = (docs.size() + run_size - 1) / run_size;
+
+    // Each run is rendered into its own buffer, and the size of each doc is kept in the offsets table until the
+    // buffers are joined.
+    std::vector<std::string> rendered(runs);
+    detail::run_parallel(runs, threads, [&](size_t i) {
+        auto &ctx = thread_context();
+        StringWriter out;
+        auto end = std::min(docs.size(), (i + 1) * run_size);
+        for (auto j = i * run_size; j < end; j++) {
+            auto start = out.buffer.size();
+            DocRenderer<StringWriter>::render(ctx, cols, engine, out, &docs[j]);
+            res.offsets[j + 1] = out.buffer.size() - start;
+        }
+        rendered[i] = std::move(out.buffer);
+    });
+
+    for (size_t i = 1; i < res.offsets.size(); i++) {
+        res.offsets[i] += res.offsets[i - 1];
+    }
+
+    res.text.reserve(res.offsets.back());
+    for (auto &run : rendered) {
+        res.text.append(run);
+    }
+
+    return res;
+}
+
+RenderedSpan Doc::render_to(std::span<char> buf, int cols, Engine engine) const {
+    SpanWriter out{buf};
+    DocRenderer<SpanWriter>::render(thread_context(), cols, engine, out, this);
+    return out.result();
+}
+
+void Doc::pretty_into(std::string &res, int cols, Engine engine) const {
+    StringWriter out;
+    out.buffer.swap(res);
+    out.buffer.clear();
+    DocRenderer<StringWriter>::render(thread_context(), cols, engine, out, this);
+    res.swap(out.buffer);
+}
+
+// The render is paused between calls to `next`, so it has a context of its own rather than the thread's.
+struct ChunkedRenderer::State {
+    Doc doc;
+    RenderContext ctx;
+    ChunkWriter out;
+    DocVisitor<DocRenderer<ChunkWriter>> renderer;
+    bool done{false};
+
+    State(Doc doc, int cols, size_t chunk_size, Engine engine)
+        : doc{std::move(doc)}, out{chunk_size}, renderer{this->ctx, 0, DocRenderer<ChunkWriter>{cols, engine, this->out}} {
+        this->renderer.start(&this->doc);
+    }
+};
+
+ChunkedRenderer::ChunkedRenderer(Doc doc, int cols, size_t chunk_size, Engine engine)
+    : state{std::make_unique<State>(std::move(doc), cols, chunk_size, engine)} {}
+
+ChunkedRenderer::~ChunkedRenderer() = default;
+
+ChunkedRenderer::ChunkedRenderer(ChunkedRenderer &&other) = default;
+
+ChunkedRenderer &ChunkedRenderer::operator=(ChunkedRenderer &&other) = default;
+
+std::optional<std::string_view> ChunkedRenderer::next() {
+    // Renderers that have been moved from have nothing left to render.
+    if (this->state == nullptr || this->state->done) {
+        return {};
+    }
+
+    auto &state = *this->state;
+
+    state.out.buffer.clear();
+    state.done = !state.renderer.resume();
+    if (state.out.buffer.empty()) {
+        return {};
+    }
+
+    return std::string_view{state.out.buffer};
+}
+
+Layout::Layout(Doc doc, int min_cols, int max_cols, Engine engine) : doc{std::move(doc)}, engine{engine} {
+    if (min_cols > max_cols) {
+        return;
+    }
+
+    DocVisitor<LayoutRanges> visitor{thread_context(), 0, LayoutRanges{engine, min_cols, max_cols, this->ranges}};
+    visitor.visit(&this->doc);
+
+    std::sort(this->ranges.begin(), this->ranges.end(), [](const Range &a, const Range &b) { return a.lo < b.lo; });
+}
+
+Layout::Layout(Doc doc, int cols, Engine engine) : Layout{std::move(doc), cols, cols, engine} {}
+
+const Layout::Range *Layout::find(int cols) const {
+    auto it = std::upper_bound(
+        this->ranges.begin(), this->ranges.end(), cols, [](int cols, const Range &range) { return cols < range.lo; });
+    if (it == this->ranges.begin()) {
+        return nullptr;
+    }
+
+    --it;
+    return cols <= it->hi ? &*it : nullptr;
+}
+
+void Layout::render(Writer &out, int cols) const {
+    RenderContext ctx;
+    this->render(ctx, out, cols);
+}
+
+void Layout::render(RenderContext &ctx, Writer &out, int cols) const {
+    if (auto *range = this->find(cols)) {
+        DocRenderer<Writer>::replay(ctx, cols, out, &this->doc, range->decisions);
+    } else {
+        DocRenderer<Writer>::render(ctx, cols, this->engine, out, &this->doc);
+    }
+}
+
+template <ConcreteWriter W> void Layout::render(W &out, int cols) const {
+    RenderContext ctx;
+    this->render(ctx, out, cols);
+}
+
+template <ConcreteWriter W> void Layout::render(RenderContext &ctx, W &out, int cols) const {
+    if (auto *range = this->find(cols)) {
+        DocRenderer<W>::replay(ctx, cols, out, &this->doc, range->decisions);
+    } else {
+        DocRenderer<W>::render(ctx, cols, this->engine, out, &this->doc);
+    }
 }
 
-std::string Doc::pretty(int cols) const {
+template void Layout::render(StringWriter &, int) const;
+template void Layout::render(RenderContext &, StringWriter &, int) const;
+template void Layout::render(StreamWriter &, int) const;
+template void Layout::render(RenderContext &, StreamWriter &, int) const;
+template void Layout::render(FdWriter &, int) const;
+template void Layout::render(RenderContext &, FdWriter &, int) const;
+template void Layout::render(MmapWriter &, int) const;
+template void Layout::render(RenderContext &, MmapWriter &, int) const;
+template void Layout::render(AsyncWriter &, int) const;
+template void Layout::render(RenderContext &, AsyncWriter &, int) const;
+
+std::string Layout::pretty(int cols) const {
     StringWriter out;
-    this->render(out, cols);
-    return out.buffer;
+    this->render(thread_context(), out, cols);
+    return std::move(out.buffer);
 }
 
 Doc Doc::angles(Doc doc) {
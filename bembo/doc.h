@@ -3,15 +3,46 @@
 
 #include <algorithm>
 #include <array>
-#include <atomic>
+#include <cassert>
+#include <concepts>
 #include <cstdint>
-#include <numeric>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <optional>
 #include <ostream>
+#include <span>
 #include <string>
 #include <vector>
 
 namespace bembo {
 
+class AsyncWriter;
+class DocArena;
+class FdWriter;
+class MmapWriter;
+
+namespace detail {
+
+struct RenderNode;
+class GeneratedDocs;
+
+// Where the size of an inlined string lives in the metadata of a `Doc`, see the layout description in `doc.cc`.
+inline constexpr uint64_t SHORT_TEXT_SIZE_SHIFT = 8;
+
+// How many runs to split work into for each thread that `run_parallel` is given, so that threads that finish early can
+// pick up the slack of the others.
+inline constexpr size_t RUNS_PER_THREAD = 8;
+
+// Call `run` with each index in `[0, runs)`, on up to `threads` threads, one of which is the calling thread. The others
+// come from a pool that's kept for the life of the process, so that their render state is reused from call to call.
+// Each thread claims the next run that no thread has taken yet until there are none left, so runs of uneven cost even
+// out.
+void run_parallel(size_t runs, size_t threads, const std::function<void(size_t)> &run);
+
+} // namespace detail
+
 class Writer {
 public:
     virtual ~Writer() = default;
@@ -21,17 +52,50 @@ public:
 
     // Emit the string.
     virtual void write(std::string_view sv) = 0;
+
+    // Called once the whole doc has been written.
+    virtual void flush() {}
+
+    // Called before text passed to `write` may be freed, which happens part way through a render as the docs built by
+    // `Doc::generate` are released. Writers that hold on to the views they're given, rather than copying the text, must
+    // copy or write out the ones they still hold.
+    virtual void detach() {}
 };
 
 class StreamWriter final : public Writer {
+public:
+    // When the underlying stream is flushed.
+    enum class Flush {
+        // Only once the whole doc has been written.
+        End,
+
+        // After every newline, as with `std::endl`.
+        Line,
+    };
+
 private:
     std::ostream &out;
+    Flush mode;
 
 public:
-    StreamWriter(std::ostream &out);
+    StreamWriter(std::ostream &out, Flush mode = Flush::End);
 
     void line(int indent) override;
     void write(std::string_view sv) override;
+    void flush() override;
+};
+
+// The algorithm used to decide whether to take the flattened branch of a choice.
+enum class Engine {
+    // Measure the flattened branch along with the content that follows it, up to the next line break, resolving any
+    // choices that follow greedily. Content may be rescanned once for every choice that precedes it.
+    Fits,
+
+    // Decide each choice in constant time, using the widths cached in each node, for O(n) work in the size of the doc
+    // regardless of how deeply groups are nested. Any choices that follow are assumed to take whichever branch is
+    // narrowest up to their next line break. This differs from `Fits` when a later group fits on its own but not with
+    // the content after it: `Fits` breaks the earlier group, while `Linear` leaves it flat and breaks the later one.
+    Linear,
 };
 
 class StringWriter final : public Writer {
@@ -44,17 +108,82 @@ public:
     void write(std::string_view sv) override;
 };
 
+// The result of rendering into a fixed size buffer.
+struct RenderedSpan {
+    // The number of bytes written to the buffer.
+    size_t size;
+
+    // True when the output didn't fit, and was cut off after `size` bytes.
+    bool truncated;
+};
+
+// How a doc lays out at a given line length, as computed by `Doc::measure`.
+struct Measurement {
+    // The number of lines in the output. Empty output is a single empty line.
+    size_t lines;
+
+    // The width of the longest line.
+    size_t max_width;
+
+    // The size of the output, including newlines and indentation.
+    size_t bytes;
+
+    // The number of lines that are wider than the line length.
+    size_t overflowing;
+};
+
+// The writers that `Doc::render` has an instantiation for that calls them directly, rather than through the virtual
+// methods of `Writer`.
+template <typename W>
+concept ConcreteWriter =
+    std::same_as<W, StringWriter> || std::same_as<W, StreamWriter> || std::same_as<W, FdWriter> ||
+    std::same_as<W, MmapWriter> || std::same_as<W, AsyncWriter>;
+
+// The work stacks used while rendering, which can be kept around and passed to `Doc::render` to reuse their storage.
+// Once the stacks have grown to fit the docs being rendered, rendering with a context doesn't allocate. A context may
+// only be used by one render at a time.
+class RenderContext final {
+    friend class Doc;
+    template <typename T> friend class DocVisitor;
+
+    template <typename W> friend class DocRenderer;
+
+    // The work stack of the renderer, followed by one stack for each level of nested lookahead by `Engine::Fits`.
+    std::vector<std::unique_ptr<std::vector<detail::RenderNode>>> stacks;
+
+    // The docs generated by the traversal at each depth, that are still in use.
+    std::vector<std::unique_ptr<detail::GeneratedDocs>> generated;
+
+    // The choices made by a measuring pass, in the order they were made, for a following render to replay.
+    std::vector<bool> decisions;
+
+    std::vector<detail::RenderNode> &stack(size_t depth);
+    detail::GeneratedDocs &generated_docs(size_t depth);
+
+public:
+    RenderContext();
+    ~RenderContext();
+
+    RenderContext(const RenderContext &) = delete;
+    RenderContext &operator=(const RenderContext &) = delete;
+};
+
 class Doc final {
+public:
+    // The header of all heap allocated nodes, holding their refcount inline with the payload.
+    struct Header;
+
 private:
+    friend class DocArena;
     friend class Fits;
-    friend class DocRenderer;
+    friend class ForcedMetrics;
+    template <typename W> friend class DocRenderer;
     template <typename T> friend class DocVisitor;
+    template <typename It, typename Sentinel> friend Doc join(It &&begin, Sentinel &&end);
+    template <typename It, typename Sentinel> friend Doc sep(Doc d, It &&begin, Sentinel &&end);
 
-    // Shared refcount for when the tag of `data` doesn't indicate an inlined case.
-    union {
-        std::array<char, 8> short_text_data;
-        std::atomic<int> *refs;
-    };
+    // Inlined string data for the `ShortText` case.
+    std::array<char, 8> short_text_data;
 
     uint64_t value;
 
@@ -68,20 +197,27 @@ private:
         Concat = 0x3,
         Choice = 0x5,
         Nest = 0x7,
+        Lazy = 0x9,
+        Generated = 0xb,
     };
 
     Tag tag() const;
-    void *data() const;
+    Header *data() const;
 
     template <typename T> T &cast() {
-        return *reinterpret_cast<T *>(this->data());
+        return *static_cast<T *>(this->data());
     }
 
     template <typename T> const T &cast() const {
-        return *reinterpret_cast<T *>(this->data());
+        return *static_cast<T *>(this->data());
     }
 
-    bool boxed() const;
+    constexpr bool boxed() const {
+        return this->value & 0x1;
+    }
+
+    bool counted() const;
+    void mark_unowned();
     void increment();
     bool decrement();
     bool is_unique() const;
@@ -89,28 +225,92 @@ private:
 
     bool is_flattened() const;
 
-    Doc(Tag tag);
-    Doc(Tag tag, void *ptr);
+    // Initialization of a variant that doesn't live in the heap.
+    constexpr Doc(Tag tag) : short_text_data{}, value{static_cast<uint64_t>(tag)} {}
+
+    Doc(Tag tag, Header *ptr, DocArena *arena);
     static Doc choice(Doc left, Doc right);
 
-    static Doc short_text(std::string_view text);
+    // Refer to a node with static storage duration, whose copies are not refcounted.
+    static Doc constant(Tag tag, Header *node);
+
+    // Construct a short text node. This assumes that the string is 8 chars or less.
+    static constexpr Doc short_text(std::string_view text) {
+        Doc res{Tag::ShortText};
+
+        auto size = text.size();
+        assert(size <= 8);
+
+        res.value |= static_cast<uint64_t>(size) << detail::SHORT_TEXT_SIZE_SHIFT;
+        std::copy_n(text.begin(), size, res.short_text_data.begin());
+
+        return res;
+    }
 
     std::string_view get_short_text() const;
 
     bool init_short_str(std::string_view str);
-    void init_string(std::string str);
+    void init_string(std::string_view str);
+
+    // Construct an empty `Concat` node.
+    static Doc make_concat();
+
+    // The children of a `Concat` node.
+    std::pmr::vector<Doc> &concat_docs();
+
+    // Make this doc into a `Concat` that can be appended to in place, and return its children.
+    std::pmr::vector<Doc> &unique_concat();
+
+    // Account for the children of this `Concat` starting at `from`: update its cached metrics, and when it lives in the
+    // current arena, transfer ownership of the children to it.
+    void register_children(size_t from);
+
+    // The width of this doc when flattened.
+    uint32_t flat_width() const;
+
+    // True when this doc never produces a line break, and is always `flat_width` wide.
+    bool single_line() const;
+
+    // The narrowest this doc can be without producing a line break, when not flattened.
+    uint32_t unbroken_width() const;
+
+    // The narrowest the text before this doc's first line break can be, when not flattened.
+    uint32_t break_width() const;
+
+    // True when this doc holds a lazy or generated doc, whose widths aren't included in the cached metrics.
+    bool has_lazy() const;
+
+    // Compute the cached metrics of a newly constructed `Choice` or `Nest` node.
+    void init_metrics();
+
+    // Build the doc held by a `Lazy` node if it hasn't been built yet, and return it.
+    const Doc &force() const;
+
+    // Build the doc at `index` of a `Generated` node.
+    Doc generated(size_t index) const;
+
+    // Call `fn`, which builds docs with user code that may render docs of its own, with the render in progress on this
+    // thread set aside.
+    template <typename Fn> static void set_aside(Fn &&fn);
 
 public:
-    ~Doc();
+    constexpr ~Doc() {
+        if (this->boxed()) {
+            this->cleanup();
+        }
+    }
 
     Doc(const Doc &other);
     Doc &operator=(const Doc &other);
 
-    Doc(Doc &&other);
+    constexpr Doc(Doc &&other) : short_text_data{other.short_text_data}, value{other.value} {
+        // the tag guides the destructor, so skip clearing out the pointer by instead turning this into a Nil.
+        other.value = 0;
+    }
     Doc &operator=(Doc &&other);
 
     // Construct an empty doc.
-    Doc();
+    constexpr Doc() : Doc{Tag::Nil} {}
 
     // Construct a Doc from a string constant.
     Doc(const char *str);
@@ -119,20 +319,32 @@ public:
     Doc(std::string_view str);
 
     // Construct an empty doc.
-    static Doc nil();
+    static constexpr Doc nil() {
+        return Doc{};
+    }
 
     // A newline.
-    static Doc line();
+    static constexpr Doc line() {
+        return Doc{Tag::Line};
+    }
 
     // A soft newline, following these rules: if there's enough space behave like a space, otherwise behave like a
-    // newline.
+    // newline. The returned doc shares a single preallocated node, and copying it doesn't touch a refcount.
     static Doc softline();
 
     // A soft break, following these rules: if there's enough space behave like nil, otherwise behave like a newline.
+    // The returned doc shares a single preallocated node, and copying it doesn't touch a refcount.
     static Doc softbreak();
 
     // A single character.
-    static Doc c(char c);
+    static constexpr Doc c(char c) {
+        return Doc::short_text(std::string_view{&c, 1});
+    }
+
+    // A string of at most eight bytes, which is always stored inline and can be built at compile time.
+    static constexpr Doc lit(std::string_view str) {
+        return Doc::short_text(str);
+    }
 
     // A string.
     static Doc s(std::string str);
@@ -151,29 +363,25 @@ public:
 
     // Append the contents of the range to this Doc by copying its elements.
     template <typename InputIt, typename Sentinel> Doc &append(InputIt &&begin, Sentinel &&end) {
-        if (this->tag() != Tag::Concat) {
-            *this = Doc{Tag::Concat, new std::vector<Doc>()};
-        }
-
-        auto &vec = this->cast<std::vector<Doc>>();
-        vec.reserve(vec.size() + std::distance(begin, end));
+        auto &vec = this->unique_concat();
+        auto start = vec.size();
+        vec.reserve(start + std::distance(begin, end));
         std::copy(begin, end, std::back_inserter(vec));
+        this->register_children(start);
 
         return *this;
     }
 
     // Append the contents of the range to this Doc by copying its elements.
     template <typename Rng> Doc &append(Rng &&rng) {
-        if (this->tag() != Tag::Concat) {
-            *this = Doc{Tag::Concat, new std::vector<Doc>()};
-        }
-
         auto begin = rng.begin();
         auto end = rng.end();
 
-        auto &vec = this->cast<std::vector<Doc>>();
-        vec.reserve(vec.size() + std::distance(begin, end));
+        auto &vec = this->unique_concat();
+        auto start = vec.size();
+        vec.reserve(start + std::distance(begin, end));
         std::copy(begin, end, std::back_inserter(vec));
+        this->register_children(start);
 
         return *this;
     }
@@ -193,6 +401,22 @@ public:
     // Append a Doc after a newline.
     Doc &operator/=(Doc other);
 
+    // A doc that's built by calling `make` when a render first reaches it, and kept from then on, so that parts of a
+    // doc that are never rendered are never built. Lookahead by `Engine::Fits` only builds the lazy docs that it reaches
+    // before deciding; `Engine::Linear` decides from the widths of everything up to the next line break, so it builds
+    // the lazy docs within a node as soon as it reaches the node. `make` is called at most once, from whichever thread
+    // reaches the doc first, with no arena current.
+    static Doc lazy(std::function<Doc()> make);
+
+    // The concatenation of `make(0)` through `make(size - 1)`. Rather than being built up front, each doc is generated
+    // when a render reaches it, and released once it's been rendered, so that rendering a long sequence only holds the
+    // docs around the current position. `make` may be called several times for an index: lookahead by `Engine::Fits`
+    // generates the docs it reaches, `Engine::Linear` generates the docs up to the next line break to measure them, and
+    // every render starts over, so it should give the same doc each time. Renders on several threads call it
+    // concurrently. Measuring at several widths, and `Layout`, hold on to the docs they generate until they finish. A
+    // sequence holds at most 2^32 - 1 docs.
+    static Doc generate(size_t size, std::function<Doc(size_t)> make);
+
     // Adjust the indentation level in `other` by `indent`.
     static Doc nest(int indent, Doc other);
 
@@ -208,20 +432,59 @@ public:
     }
 
     // Render the document out assuming a line length of `cols`.
-    void render(Writer &target, int cols) const;
+    void render(Writer &target, int cols, Engine engine = Engine::Fits) const;
 
-    // Render to a string.
-    std::string pretty(int cols) const;
+    // Render the document out assuming a line length of `cols`, reusing the work stacks in `ctx`.
+    void render(RenderContext &ctx, Writer &target, int cols, Engine engine = Engine::Fits) const;
+
+    // Render the document to one of the writers provided by this library, whose methods are inlined into the renderer.
+    template <ConcreteWriter W> void render(W &target, int cols, Engine engine = Engine::Fits) const;
+
+    // Render the document to one of the writers provided by this library, reusing the work stacks in `ctx`.
+    template <ConcreteWriter W> void render(RenderContext &ctx, W &target, int cols, Engine engine = Engine::Fits) const;
+
+    // Render to a string. The size of the output is measured first, so the string is allocated exactly once.
+    std::string pretty(int cols, Engine engine = Engine::Fits) const;
+
+    // Render into `buf`, stopping as soon as it's full. Neither this nor `pretty_into` allocate once the calling
+    // thread has rendered a doc of similar shape, as they reuse a `RenderContext` that's kept for each thread.
+    RenderedSpan render_to(std::span<char> buf, int cols, Engine engine = Engine::Fits) const;
+
+    // Render to a string, replacing its contents while reusing its capacity.
+    void pretty_into(std::string &out, int cols, Engine engine = Engine::Fits) const;
+
+    // Render the document on up to `threads` threads. The line breaks at the top level of the doc, outside of any
+    // group, split it into segments whose layout doesn't depend on each other, which are rendered in parallel and
+    // written to `target` in order. The output is the same as that of `render`.
+    void render_parallel(Writer &target, int cols, size_t threads, Engine engine = Engine::Fits) const;
+
+    // Render to a string on up to `threads` threads, as with `render_parallel`.
+    std::string pretty_parallel(int cols, size_t threads, Engine engine = Engine::Fits) const;
+
+    // Lay the document out assuming a line length of `cols`, and measure the output without producing it.
+    Measurement measure(int cols, Engine engine = Engine::Fits) const;
+
+    // Measure the document at each of `widths`. The widths share a single traversal of the doc for as long as their
+    // layouts agree, rather than each repeating it from the start.
+    std::vector<Measurement> measure(std::span<const int> widths, Engine engine = Engine::Fits) const;
+
+    // Render the document at each of `widths`, sharing the traversal as `measure` does.
+    std::vector<std::string> pretty(std::span<const int> widths, Engine engine = Engine::Fits) const;
+
+    // The narrowest line length at which the document fits in at most `lines` lines, without any line overflowing, or
+    // nothing if it never does. This bisects the possible line lengths, so it assumes that widening the line never
+    // makes the document stop fitting.
+    std::optional<int> min_width(size_t lines, Engine engine = Engine::Fits) const;
 
 private:
-    template <typename... Docs> static void concat_impl(std::vector<Doc> &acc, Doc arg, Docs &&...rest) {
+    template <typename... Docs> static void concat_impl(std::pmr::vector<Doc> &acc, Doc arg, Docs &&...rest) {
         acc.emplace_back(std::move(arg));
         if constexpr (sizeof...(Docs) > 0) {
             concat_impl(acc, std::forward<Docs>(rest)...);
         }
     }
 
-    template <typename... Docs> static void vcat_impl(std::vector<Doc> &acc, Doc arg, Docs &&...rest) {
+    template <typename... Docs> static void vcat_impl(std::pmr::vector<Doc> &acc, Doc arg, Docs &&...rest) {
         acc.emplace_back(std::move(arg));
         if constexpr (sizeof...(Docs) > 0) {
             acc.emplace_back(Doc::line());
@@ -231,18 +494,20 @@ private:
 
 public:
     template <typename... Docs> static Doc concat(Docs &&...rest) {
-        Doc res{Tag::Concat, new std::vector<Doc>()};
-        auto &acc = res.cast<std::vector<Doc>>();
+        Doc res = Doc::make_concat();
+        auto &acc = res.concat_docs();
         acc.reserve(sizeof...(Docs));
         concat_impl(acc, std::forward<Docs>(rest)...);
+        res.register_children(0);
         return res;
     }
 
     template <typename... Docs> static Doc vcat(Docs &&...rest) {
-        Doc res{Tag::Concat, new std::vector<Doc>()};
-        auto &acc = res.cast<std::vector<Doc>>();
+        Doc res = Doc::make_concat();
+        auto &acc = res.concat_docs();
         acc.reserve(sizeof...(Docs) + sizeof...(Docs) - 1);
         vcat_impl(acc, std::forward<Docs>(rest)...);
+        res.register_children(0);
         return res;
     }
 
@@ -254,12 +519,134 @@ public:
     static Doc parens(Doc doc);
 };
 
+// The layout of a doc at every line length in the range `[min_cols, max_cols]`, so that the doc can be rendered again
+// at a new line length without deciding any of its choices, as when a terminal is resized. Given the choices before
+// it, a choice takes its flattened branch at every line length past some threshold, so the range splits into spans
+// that each lay the doc out the same way. Rendering looks up the span for the line length, and replays its choices.
+// Line lengths outside of the range are rendered as usual. The layout holds a reference to its doc.
+class Layout final {
+    friend class LayoutRanges;
+
+    // A span of line lengths that lay the doc out the same way, and the choices they make in the order they're reached.
+    struct Range {
+        int lo;
+        int hi;
+        std::vector<bool> decisions;
+    };
+
+    Doc doc;
+    Engine engine;
+
+    // Sorted by line length.
+    std::vector<Range> ranges;
+
+    const Range *find(int cols) const;
+
+public:
+    Layout(Doc doc, int min_cols, int max_cols, Engine engine = Engine::Fits);
+
+    // The layout of `doc` at a single line length, which holds one decision per choice. It's only read while
+    // rendering, so the same layout can be rendered to several writers, on any thread.
+    Layout(Doc doc, int cols, Engine engine = Engine::Fits);
+
+    // The number of distinct layouts in the range.
+    size_t size() const {
+        return this->ranges.size();
+    }
+
+    // Render the doc assuming a line length of `cols`.
+    void render(Writer &target, int cols) const;
+
+    // Render the doc assuming a line length of `cols`, reusing the work stacks in `ctx`.
+    void render(RenderContext &ctx, Writer &target, int cols) const;
+
+    // Render the doc to one of the writers provided by this library, whose methods are inlined into the renderer.
+    template <ConcreteWriter W> void render(W &target, int cols) const;
+
+    // Render the doc to one of the writers provided by this library, reusing the work stacks in `ctx`.
+    template <ConcreteWriter W> void render(RenderContext &ctx, W &target, int cols) const;
+
+    // Render to a string.
+    std::string pretty(int cols) const;
+};
+
+// Renders a doc a chunk at a time, for callers that can't wait for the whole doc to be rendered, such as an event
+// loop. Each call to `next` carries on from where the last one left off, until at least `chunk_size` bytes of output
+// are ready. Between calls, the render is held as its work stacks, so the memory used doesn't grow with the size of the
+// output, and the render can be stopped at any point by dropping the renderer. The renderer holds a reference to its
+// doc, and may be moved to another thread between calls.
+class ChunkedRenderer final {
+    struct State;
+    std::unique_ptr<State> state;
+
+public:
+    ChunkedRenderer(Doc doc, int cols, size_t chunk_size = 4096, Engine engine = Engine::Fits);
+    ~ChunkedRenderer();
+
+    ChunkedRenderer(ChunkedRenderer &&other);
+    ChunkedRenderer &operator=(ChunkedRenderer &&other);
+
+    // The next chunk of output, which is valid until the next call, or nothing once the whole doc has been rendered.
+    // Chunks are only smaller than `chunk_size` at the end of the output, and may be larger when a single piece of
+    // text doesn't fit.
+    std::optional<std::string_view> next();
+};
+
+// The output of `render_batch`: the renders of a list of docs, one after another in a single string.
+struct RenderedBatch {
+    std::string text;
+
+    // Where the render of each doc starts in `text`, followed by the size of `text`.
+    std::vector<size_t> offsets{0};
+
+    // The number of docs rendered.
+    size_t size() const {
+        return this->offsets.size() - 1;
+    }
+
+    // The render of the `i`th doc.
+    std::string_view operator[](size_t i) const {
+        return std::string_view{this->text}.substr(this->offsets[i], this->offsets[i + 1] - this->offsets[i]);
+    }
+};
+
+// Render each of `docs` on up to `threads` threads. Each thread renders runs of docs with its own `RenderContext`,
+// claiming the next run once it's done. The threads other than the calling one are kept in a pool between calls, along
+// with their contexts.
+RenderedBatch render_batch(std::span<const Doc> docs, int cols, size_t threads, Engine engine = Engine::Fits);
+
+namespace literals {
+
+// A doc literal. Strings of at most eight bytes are stored inline, and can be used in constant expressions:
+//
+//     constexpr Doc arrow = "->"_doc;
+constexpr Doc operator""_doc(const char *str, size_t len) {
+    if (len <= 8) {
+        return Doc::lit(std::string_view{str, len});
+    }
+    return Doc::sv(std::string_view{str, len});
+}
+
+} // namespace literals
+
+// `join` and `sep` fill a single `Concat` rather than appending one doc at a time: nodes in an arena are never unique,
+// so appending would nest a new `Concat` for every element.
 template <typename It, typename Sentinel> Doc join(It &&begin, Sentinel &&end) {
-    return std::accumulate(std::forward<It>(begin), std::forward<Sentinel>(end), Doc::nil());
+    Doc res;
+
+    if (begin == end) {
+        return res;
+    }
+
+    auto &docs = res.unique_concat();
+    std::copy(std::forward<It>(begin), std::forward<Sentinel>(end), std::back_inserter(docs));
+    res.register_children(0);
+
+    return res;
 }
 
 template <typename Range> Doc join(Range &&rng) {
-    return std::accumulate(rng.begin(), rng.end(), Doc::nil());
+    return join(rng.begin(), rng.end());
 }
 
 template <typename It, typename Sentinel> Doc sep(Doc d, It &&begin, Sentinel &&end) {
@@ -269,17 +656,19 @@ template <typename It, typename Sentinel> Doc sep(Doc d, It &&begin, Sentinel &&
         return res;
     }
 
+    auto &docs = res.unique_concat();
     while (true) {
         Doc chunk = *begin;
         ++begin;
 
         if (begin == end) {
-            res += chunk;
+            docs.emplace_back(std::move(chunk));
             break;
         }
 
-        res += Doc::group(chunk + d);
+        docs.emplace_back(Doc::group(chunk + d));
     }
+    res.register_children(0);
 
     return res;
 }
@@ -288,6 +677,27 @@ template <typename Range> Doc sep(Doc d, Range &&rng) {
     return sep(std::move(d), rng.begin(), rng.end());
 }
 
+// As `join`, over the docs projected from `[begin, end)` by `proj`, which are generated while rendering as with
+// `Doc::generate`. The elements must outlive the doc.
+template <std::random_access_iterator It, typename Proj = std::identity>
+Doc generate(It begin, It end, Proj proj = {}) {
+    return Doc::generate(end - begin, [begin, proj](size_t i) -> Doc { return std::invoke(proj, begin[i]); });
+}
+
+// As `sep`, over the docs projected from `[begin, end)` by `proj`, which are generated while rendering as with
+// `Doc::generate`. The elements must outlive the doc.
+template <std::random_access_iterator It, typename Proj = std::identity>
+Doc generate_sep(Doc d, It begin, It end, Proj proj = {}) {
+    size_t size = end - begin;
+    return Doc::generate(size, [d, begin, proj, size](size_t i) -> Doc {
+        Doc chunk = std::invoke(proj, begin[i]);
+        if (i + 1 == size) {
+            return chunk;
+        }
+        return Doc::group(chunk + d);
+    });
+}
+
 } // namespace bembo
 
 #endif
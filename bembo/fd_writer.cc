@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+#include "bembo/fd_writer.h"
+
+namespace bembo {
+
+namespace {
+
+// Newlines and indentation are written as views into this buffer, so that a line and its indentation take up a single
+// iovec.
+constexpr std::string_view NEWLINE{"\n                                                                "};
+
+} // namespace
+
+FdWriter::FdWriter(int fd) : fd{fd} {}
+
+FdWriter::~FdWriter() {
+    this->flush();
+}
+
+void FdWriter::push(std::string_view sv) {
+    if (sv.empty()) {
+        return;
+    }
+
+    // Extend the previous iovec when the bytes follow on from it, as with text that was split into several writes.
+    if (this->pending > 0) {
+        auto &last = this->iovs[this->pending - 1];
+        if (static_cast<const char *>(last.iov_base) + last.iov_len == sv.data()) {
+            last.iov_len += sv.size();
+            return;
+        }
+    }
+
+    if (this->pending == BATCH_SIZE) {
+        this->flush();
+    }
+
+    // `writev` doesn't write through the iovecs, so dropping const here is fine.
+    this->iovs[this->pending++] = iovec{const_cast<char *>(sv.data()), sv.size()};
+}
+
+void FdWriter::line(int indent) {
+    auto chunk = std::min<size_t>(indent, NEWLINE.size() - 1);
+    this->push(NEWLINE.substr(0, chunk + 1));
+    indent -= chunk;
+
+    while (indent > 0) {
+        chunk = std::min<size_t>(indent, NEWLINE.size() - 1);
+        this->push(NEWLINE.substr(1, chunk));
+        indent -= chunk;
+    }
+}
+
+void FdWriter::write(std::string_view sv) {
+    this->push(sv);
+}
+
+void FdWriter::flush() {
+    auto *iov = this->iovs.data();
+    auto count = this->pending;
+    this->pending = 0;
+    this->detached = 0;
+
+    while (count > 0 && this->err == 0) {
+        auto written = ::writev(this->fd, iov, static_cast<int>(count));
+        if (written < 0) {
+            if (errno != EINTR) {
+                this->err = errno;
+            }
+            continue;
+        }
+
+        // Skip over the iovecs that were written in full, and adjust the first one that was only written in part.
+        auto remaining = static_cast<size_t>(written);
+        while (count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+
+    this->copied.clear();
+}
+
+void FdWriter::detach() {
+    size_t size = 0;
+    for (auto i = this->detached; i < this->pending; i++) {
+        size += this->iovs[i].iov_len;
+    }
+
+    // The iovecs point into the copied text, so it can't be reallocated while they're pending.
+    if (this->copied.capacity() < COPY_SIZE) {
+        this->copied.reserve(COPY_SIZE);
+    }
+    if (this->copied.size() + size > this->copied.capacity()) {
+        this->flush();
+        return;
+    }
+
+    for (auto i = this->detached; i < this->pending; i++) {
+        auto &iov = this->iovs[i];
+        auto *base = static_cast<const char *>(iov.iov_base);
+        if (base >= NEWLINE.data() && base < NEWLINE.data() + NEWLINE.size()) {
+            continue;
+        }
+
+        auto start = this->copied.size();
+        this->copied.append(base, iov.iov_len);
+        iov.iov_base = this->copied.data() + start;
+    }
+    this->detached = this->pending;
+}
+
+} // namespace bembo
@@ -0,0 +1,67 @@
+#ifndef BEMBO_FD_WRITER_H
+#define BEMBO_FD_WRITER_H
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+
+#include "bembo/doc.h"
+
+namespace bembo {
+
+// Writes to a POSIX file descriptor with `writev`, without copying any text. Each write is recorded as an iovec that
+// points at the caller's bytes, which for a render are the text stored in the doc's nodes, and indentation points into
+// a static buffer of spaces. The gathered iovecs are written out in batches, whenever the batch fills up and on
+// `flush`.
+//
+// As the bytes aren't copied, views passed to `write` must stay valid until the next `flush`, which `Doc::render`
+// calls before returning, or `detach`, which it calls before releasing the docs built by `Doc::generate`. Those copy
+// the text that's still pending into a buffer of the writer's own, or write it out once the buffer is full.
+class FdWriter final : public Writer {
+public:
+    // The number of iovecs gathered before they're written out, which is the usual value of `IOV_MAX`.
+    static constexpr size_t BATCH_SIZE = 1024;
+
+    // How much pending text `detach` copies before it writes it out instead.
+    static constexpr size_t COPY_SIZE = 64 << 10;
+
+private:
+    int fd;
+
+    // The `errno` of the first failed write, after which all output is dropped.
+    int err{0};
+
+    size_t pending{0};
+    std::array<iovec, BATCH_SIZE> iovs;
+
+    // The text copied by `detach`, and how many of the pending iovecs no longer point at the caller's bytes.
+    std::string copied;
+    size_t detached{0};
+
+    void push(std::string_view sv);
+
+public:
+    // Write to `fd`, which is not closed by the writer.
+    explicit FdWriter(int fd);
+
+    ~FdWriter();
+
+    FdWriter(const FdWriter &other) = delete;
+    FdWriter &operator=(const FdWriter &other) = delete;
+
+    void line(int indent) override;
+    void write(std::string_view sv) override;
+    void flush() override;
+    void detach() override;
+
+    // The `errno` value of the first write that failed, or `0` if all writes succeeded.
+    int error() const {
+        return this->err;
+    }
+};
+
+} // namespace bembo
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef BEMBO_FORMAT_H
+#define BEMBO_FORMAT_H
+
+#if __has_include(<format>)
+#include <format>
+#endif
+
+#ifdef __cpp_lib_format
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <string_view>
+
+#include "bembo/doc.h"
+
+namespace bembo::detail {
+
+// Writes to the output iterator of a format context.
+template <typename Out> class FormatWriter final : public Writer {
+public:
+    Out out;
+
+    explicit FormatWriter(Out out) : out{out} {}
+
+    void line(int indent) override {
+        *this->out++ = '\n';
+        this->out = std::fill_n(this->out, indent, ' ');
+    }
+
+    void write(std::string_view sv) override {
+        this->out = std::copy(sv.begin(), sv.end(), this->out);
+    }
+};
+
+} // namespace bembo::detail
+
+namespace std {
+
+// Format a doc by rendering it directly into the output, using the width of the format spec as the line length:
+// `std::format("{:80}", doc)`. Without a width, lines are 80 columns.
+template <> struct formatter<bembo::Doc, char> {
+    // The widest line length the format spec can give.
+    static constexpr int MAX_COLS = std::numeric_limits<int>::max();
+
+    int cols = 80;
+
+    constexpr auto parse(format_parse_context &ctx) {
+        auto it = ctx.begin();
+        if (it != ctx.end() && *it >= '0' && *it <= '9') {
+            this->cols = 0;
+            while (it != ctx.end() && *it >= '0' && *it <= '9') {
+                auto digit = *it - '0';
+                if (this->cols > (MAX_COLS - digit) / 10) {
+                    formatter::fail("width in format spec for bembo::Doc is too large");
+                }
+                this->cols = this->cols * 10 + digit;
+                ++it;
+            }
+        }
+
+        if (it != ctx.end() && *it != '}') {
+            formatter::fail("invalid format spec for bembo::Doc, expected a width");
+        }
+
+        return it;
+    }
+
+    [[noreturn]] static constexpr void fail(const char *message) {
+#ifdef __cpp_exceptions
+        throw format_error(message);
+#else
+        (void)message;
+        std::abort();
+#endif
+    }
+
+    template <typename FormatContext> auto format(const bembo::Doc &doc, FormatContext &ctx) const {
+        bembo::detail::FormatWriter out{ctx.out()};
+        doc.render(out, this->cols);
+        return out.out;
+    }
+};
+
+} // namespace std
+
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "bembo/mmap_writer.h"
+
+namespace bembo {
+
+MmapWriter::MmapWriter(int fd, size_t chunk_size) : fd{fd}, chunk_size{chunk_size} {
+    auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    this->chunk_size = std::max(page, (chunk_size + page - 1) / page * page);
+}
+
+MmapWriter::~MmapWriter() {
+    this->flush();
+    if (this->data != nullptr) {
+        ::munmap(this->data, this->mapped);
+    }
+}
+
+bool MmapWriter::reserve(size_t extra) {
+    if (this->err != 0) {
+        return false;
+    }
+
+    if (this->size + extra <= this->capacity) {
+        return true;
+    }
+
+    auto needed = this->size + extra - this->capacity;
+    auto capacity = this->capacity + (needed + this->chunk_size - 1) / this->chunk_size * this->chunk_size;
+    if (::ftruncate(this->fd, capacity) != 0) {
+        this->err = errno;
+        return false;
+    }
+
+    // The mapping is left in place when the file is truncated by `flush`, so it may already cover the new size.
+    if (capacity > this->mapped) {
+        void *data;
+        if (this->data == nullptr) {
+            data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+        } else {
+#ifdef __linux__
+            data = ::mremap(this->data, this->mapped, capacity, MREMAP_MAYMOVE);
+#else
+            ::munmap(this->data, this->mapped);
+            data = ::mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+#endif
+        }
+
+        if (data == MAP_FAILED) {
+            this->err = errno;
+            this->data = nullptr;
+            this->mapped = 0;
+            return false;
+        }
+
+        this->data = static_cast<char *>(data);
+        this->mapped = capacity;
+    }
+
+    this->capacity = capacity;
+    return true;
+}
+
+void MmapWriter::line(int indent) {
+    if (!this->reserve(1 + indent)) {
+        return;
+    }
+
+    this->data[this->size] = '\n';
+    std::memset(this->data + this->size + 1, ' ', indent);
+    this->size += 1 + indent;
+}
+
+void MmapWriter::write(std::string_view sv) {
+    if (!this->reserve(sv.size())) {
+        return;
+    }
+
+    std::memcpy(this->data + this->size, sv.data(), sv.size());
+    this->size += sv.size();
+}
+
+void MmapWriter::flush() {
+    if (this->err != 0) {
+        return;
+    }
+
+    // The file is truncated even if nothing was written to it, as it may still hold whatever was there before.
+    // Pages past the end of the file must not be touched, so later writes will grow the file again before using them.
+    if (::ftruncate(this->fd, this->size) != 0) {
+        this->err = errno;
+        return;
+    }
+
+    this->capacity = this->size;
+}
+
+} // namespace bembo
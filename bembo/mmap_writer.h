@@ -0,0 +1,57 @@
+#ifndef BEMBO_MMAP_WRITER_H
+#define BEMBO_MMAP_WRITER_H
+
+#include <cstddef>
+#include <string_view>
+
+#include "bembo/doc.h"
+
+namespace bembo {
+
+// Writes to a file by mapping it into memory, so that each write is a `memcpy` into the mapped pages. The file is
+// grown in chunks of `chunk_size` bytes as output is written, and truncated to the size of the output on `flush`,
+// which `Doc::render` calls before returning. Output starts at the beginning of the file, replacing its contents.
+class MmapWriter final : public Writer {
+public:
+    // The default amount the file is grown by when it fills up.
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 64 << 20;
+
+private:
+    int fd;
+    size_t chunk_size;
+
+    // The `errno` of the first failed operation, after which all output is dropped.
+    int err{0};
+
+    char *data{nullptr};
+
+    // The length of the mapping, the size of the file, and the number of bytes written.
+    size_t mapped{0};
+    size_t capacity{0};
+    size_t size{0};
+
+    // Make room for at least `extra` more bytes, returning false on failure.
+    bool reserve(size_t extra);
+
+public:
+    // Write to `fd`, which must be open for reading and writing, and is not closed by the writer.
+    explicit MmapWriter(int fd, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+    ~MmapWriter();
+
+    MmapWriter(const MmapWriter &other) = delete;
+    MmapWriter &operator=(const MmapWriter &other) = delete;
+
+    void line(int indent) override;
+    void write(std::string_view sv) override;
+    void flush() override;
+
+    // The `errno` value of the first operation that failed, or `0` if everything succeeded.
+    int error() const {
+        return this->err;
+    }
+};
+
+} // namespace bembo
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef BEMBO_PARALLEL_H
+#define BEMBO_PARALLEL_H
+
+#include <algorithm>
+#include <execution>
+#include <iterator>
+#include <ranges>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "bembo/doc.h"
+
+// Overloads of `join` and `sep` that build their result on several threads, for very large ranges. They take an
+// execution policy: `std::execution::seq` builds on the calling thread, and any other policy builds on up to one
+// thread per core. The threads come from the pool that bembo keeps for rendering, rather than from the standard
+// library's parallel algorithms, so that using them doesn't need a parallel backend such as TBB.
+//
+// The docs in the range are copied from several threads at once, so these must not be used with the build of the
+// library that has non-atomic refcounts, unless the policy is `std::execution::seq`.
+
+namespace bembo {
+
+namespace detail {
+
+// Build `make(0)` to `make(n - 1)` in runs, and concatenate them into a single flat `Concat`. The calling thread builds
+// runs too, and the docs it builds go into its active `DocArena` if it has one, while docs built on other threads are
+// allocated on the heap. The result then mixes arena and heap nodes, and must not outlive that arena.
+template <typename Policy, typename Fn> Doc concat_parallel(Policy &&, size_t n, Fn &&make) {
+    // Enough docs in each run that claiming it costs little in comparison.
+    constexpr size_t RUN_SIZE = 4096;
+
+    if (n == 0) {
+        return Doc::nil();
+    }
+
+    std::vector<Doc> docs(n);
+    size_t threads = 1;
+    if constexpr (!std::is_same_v<std::remove_cvref_t<Policy>, std::execution::sequenced_policy>) {
+        threads = std::thread::hardware_concurrency();
+    }
+
+    detail::run_parallel((n + RUN_SIZE - 1) / RUN_SIZE, threads, [&](size_t run) {
+        auto end = std::min(n, (run + 1) * RUN_SIZE);
+        for (auto i = run * RUN_SIZE; i < end; i++) {
+            docs[i] = make(i);
+        }
+    });
+
+    Doc res;
+    res.append(std::make_move_iterator(docs.begin()), std::make_move_iterator(docs.end()));
+    return res;
+}
+
+} // namespace detail
+
+// Concatenate the docs in `rng`, as `join` does. Only copying the handles out of the range happens in parallel, and
+// splicing them into the result stays serial, so this is rarely faster than `join`.
+template <typename Policy, std::ranges::random_access_range Range>
+    requires std::is_execution_policy_v<std::remove_cvref_t<Policy>>
+Doc join(Policy &&policy, Range &&rng) {
+    auto begin = std::ranges::begin(rng);
+    return detail::concat_parallel(
+        std::forward<Policy>(policy), std::ranges::size(rng), [&begin](size_t i) -> Doc { return begin[i]; });
+}
+
+// Separate the docs in `rng` with `d`, grouping each doc with the separator that follows it, as `sep` does.
+template <typename Policy, std::ranges::random_access_range Range>
+    requires std::is_execution_policy_v<std::remove_cvref_t<Policy>>
+Doc sep(Policy &&policy, Doc d, Range &&rng) {
+    auto begin = std::ranges::begin(rng);
+    size_t n = std::ranges::size(rng);
+    return detail::concat_parallel(std::forward<Policy>(policy), n, [&begin, &d, n](size_t i) -> Doc {
+        if (i + 1 == n) {
+            return begin[i];
+        }
+        return Doc::group(begin[i] + d);
+    });
+}
+
+} // namespace bembo
+
+#endif
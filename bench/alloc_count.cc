@@ -0,0 +1,68 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "bench/alloc_count.h"
+
+namespace {
+
+std::atomic<size_t> allocs{0};
+std::atomic<size_t> frees{0};
+std::atomic<size_t> bytes{0};
+
+void *counted_alloc(size_t size) {
+    allocs.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    if (auto *ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    std::abort();
+}
+
+void counted_free(void *ptr) {
+    if (ptr != nullptr) {
+        frees.fetch_add(1, std::memory_order_relaxed);
+        std::free(ptr);
+    }
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+    return counted_alloc(size);
+}
+
+void *operator new[](size_t size) {
+    return counted_alloc(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    counted_free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    counted_free(ptr);
+}
+
+namespace bembo::bench {
+
+AllocCount alloc_count() {
+    return AllocCount{allocs.load(), frees.load(), bytes.load()};
+}
+
+AllocScope::AllocScope() : start{alloc_count()} {}
+
+AllocCount AllocScope::get() const {
+    auto now = alloc_count();
+    return AllocCount{now.allocs - this->start.allocs, now.frees - this->start.frees, now.bytes - this->start.bytes};
+}
+
+} // namespace bembo::bench
@@ -0,0 +1,29 @@
+#ifndef BEMBO_BENCH_ALLOC_COUNT_H
+#define BEMBO_BENCH_ALLOC_COUNT_H
+
+#include <cstddef>
+
+namespace bembo::bench {
+
+// Counters maintained by the global `operator new` and `operator delete` replacements in `alloc_count.cc`.
+struct AllocCount {
+    size_t allocs;
+    size_t frees;
+    size_t bytes;
+};
+
+AllocCount alloc_count();
+
+// The allocations performed between construction and `get`.
+class AllocScope {
+    AllocCount start;
+
+public:
+    AllocScope();
+
+    AllocCount get() const;
+};
+
+} // namespace bembo::bench
+
+#endif
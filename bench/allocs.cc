@@ -0,0 +1,110 @@
+#include <array>
+#include <cstdio>
+#include <string>
+
+#include "bembo/doc.h"
+#include "bench/alloc_count.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+template <typename Fn> void measure(const char *name, Fn &&build) {
+    AllocScope scope;
+    {
+        Doc doc = build();
+        auto built = scope.get();
+        std::printf("%-24s %10zu allocs %12zu bytes", name, built.allocs, built.bytes);
+    }
+    std::printf(" %10zu frees\n", scope.get().frees);
+
+    auto ns = time_ns(20, [&] { Doc doc = build(); });
+    report(name, ns);
+}
+
+// Render `doc` repeatedly with a shared context, after warming up the context and the writer's buffer, and return the
+// number of allocations made by the steady state renders.
+size_t measure_render(const char *name, const Doc &doc, Engine engine) {
+    RenderContext ctx;
+    StringWriter out;
+    doc.render(ctx, out, 80, engine);
+
+    AllocScope scope;
+    for (int i = 0; i < 100; i++) {
+        out.buffer.clear();
+        doc.render(ctx, out, 80, engine);
+    }
+    auto allocs = scope.get().allocs;
+    std::printf("%-24s %10zu allocs\n", name, allocs);
+
+    auto ns = time_ns(20, [&] {
+        out.buffer.clear();
+        doc.render(ctx, out, 80, engine);
+    });
+    report(name, ns);
+
+    return allocs;
+}
+
+} // namespace
+
+int main() {
+    measure("xml(8, 4)", [] { return xml(8, 4); });
+    measure("words(100000)", [] { return words(100000); });
+    measure("long text x 100000", [] {
+        Doc res;
+        for (int i = 0; i < 100000; i++) {
+            res += Doc::sv("a longer piece of text");
+        }
+        return res;
+    });
+
+    // Rendering with a warmed up context must not allocate.
+    auto doc = xml(8, 4);
+    size_t allocs = 0;
+    allocs += measure_render("render xml(8, 4)", doc, Engine::Fits);
+    allocs += measure_render("render xml(8, 4) linear", doc, Engine::Linear);
+
+    // Neither should rendering into a fixed buffer, or into a string that's already large enough.
+    {
+        static std::array<char, 1 << 20> buf;
+        std::string str;
+        doc.render_to(buf, 80);
+        doc.pretty_into(str, 80);
+
+        AllocScope scope;
+        for (int i = 0; i < 100; i++) {
+            doc.render_to(buf, 80);
+            doc.pretty_into(str, 80);
+        }
+        auto span_allocs = scope.get().allocs;
+        std::printf("%-24s %10zu allocs\n", "render_to, pretty_into", span_allocs);
+        allocs += span_allocs;
+    }
+
+    // `pretty` measures the output first, so it only allocates the string it returns.
+    {
+        doc.pretty(80);
+
+        AllocScope scope;
+        auto str = doc.pretty(80);
+        std::printf("%-24s %10zu allocs %12zu bytes\n", "pretty xml(8, 4)", scope.get().allocs, str.size());
+        report("pretty xml(8, 4)", time_ns(20, [&] { doc.pretty(80); }));
+    }
+
+    // Measuring doesn't produce any output, so it doesn't allocate either.
+    {
+        doc.measure(80);
+
+        AllocScope scope;
+        auto m = doc.measure(80);
+        auto measure_allocs = scope.get().allocs;
+        std::printf("%-24s %10zu allocs %12zu bytes\n", "measure xml(8, 4)", measure_allocs, m.bytes);
+        report("measure xml(8, 4)", time_ns(20, [&] { doc.measure(80); }));
+        allocs += measure_allocs;
+    }
+
+    return allocs == 0 ? 0 : 1;
+}
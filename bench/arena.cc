@@ -0,0 +1,35 @@
+#include "bembo/arena.h"
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+template <typename Fn> void compare(std::string_view name, int iters, Fn &&build) {
+    auto heap = time_ns(iters, [&] {
+        Doc doc = build();
+        doc.pretty(80);
+    });
+
+    auto arena = time_ns(iters, [&] {
+        DocArena arena;
+        DocArena::Scope scope{arena};
+        Doc doc = build();
+        doc.pretty(80);
+    });
+
+    report(std::string{name} + " heap", heap);
+    report(std::string{name} + " arena", arena);
+}
+
+} // namespace
+
+int main() {
+    compare("xml(8, 4)", 10, [] { return xml(8, 4); });
+    compare("xml(3, 10)", 1000, [] { return xml(3, 10); });
+    compare("words(100000)", 10, [] { return words(100000); });
+    compare("words(100)", 10000, [] { return words(100); });
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+int main() {
+    std::vector<Doc> docs;
+    for (int i = 0; i < 20000; i++) {
+        docs.emplace_back(xml(2 + i % 3, 3));
+    }
+
+    auto throughput = [&](std::string_view name, double ns) {
+        std::printf("%-40.*s %14.1f docs/s\n", static_cast<int>(name.size()), name.data(), docs.size() / (ns / 1e9));
+    };
+
+    throughput("pretty each", time_ns(3, [&] {
+                   for (auto &doc : docs) {
+                       doc.pretty(80);
+                   }
+               }));
+
+    // Powers of two up to the number of cores, and then the number of cores itself.
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1;; threads = std::min(threads * 2, cores)) {
+        throughput("render_batch " + std::to_string(threads) + " threads",
+                   time_ns(3, [&] { render_batch(docs, 80, threads); }));
+        if (threads == cores) {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef BEMBO_BENCH_BENCH_H
+#define BEMBO_BENCH_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bembo/doc.h"
+
+namespace bembo::bench {
+
+// Run `fn` `iters` times, and return the average time per run in nanoseconds.
+template <typename Fn> double time_ns(int iters, Fn &&fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; i++) {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iters;
+}
+
+inline void report(std::string_view name, double ns) {
+    std::printf("%-40.*s %14.1f ns\n", static_cast<int>(name.size()), name.data(), ns);
+}
+
+// An xml-like tag, as in `tests/tests.cc`.
+inline Doc tag(std::string_view name, Doc body = Doc::nil()) {
+    if (body.is_nil()) {
+        return Doc::angles(Doc::sv(name) << Doc::c('/'));
+    } else {
+        auto tag = Doc::sv(name);
+        return Doc::concat(
+            Doc::angles(tag),
+            Doc::group(Doc::concat(Doc::nest(2, Doc::softbreak() + body), Doc::softbreak())),
+            Doc::angles(Doc::c('/') + tag));
+    }
+}
+
+// A tree of tags, `depth` deep where each inner node has `breadth` children.
+inline Doc xml(int depth, int breadth) {
+    if (depth == 0) {
+        return tag("leaf");
+    }
+
+    std::vector<Doc> children;
+    children.reserve(breadth);
+    for (int i = 0; i < breadth; i++) {
+        children.emplace_back(xml(depth - 1, breadth));
+    }
+
+    return tag("node", bembo::sep(Doc::softline(), children));
+}
+
+// A paragraph of `n` words separated by soft lines.
+inline Doc words(int n) {
+    std::vector<Doc> ws;
+    ws.reserve(n);
+    for (int i = 0; i < n; i++) {
+        ws.emplace_back(Doc::s("word" + std::to_string(i)));
+    }
+
+    return bembo::sep(Doc::c(',') + Doc::softline(), ws);
+}
+
+} // namespace bembo::bench
+
+#endif
@@ -0,0 +1,40 @@
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+// Rendering a large doc a chunk at a time, as an event loop would, against rendering it in one go. The longest single
+// call to `next` bounds how long the loop is kept waiting.
+int main() {
+    auto doc = xml(8, 5);
+
+    report("pretty", time_ns(3, [&] { doc.pretty(80); }));
+
+    for (size_t chunk_size : {256, 4096, 65536}) {
+        double longest = 0;
+        auto ns = time_ns(3, [&] {
+            ChunkedRenderer renderer{doc, 80, chunk_size};
+            while (true) {
+                auto start = std::chrono::steady_clock::now();
+                auto chunk = renderer.next();
+                auto end = std::chrono::steady_clock::now();
+                longest = std::max(longest, std::chrono::duration<double, std::nano>(end - start).count());
+
+                if (!chunk) {
+                    break;
+                }
+            }
+        });
+
+        auto name = "chunks of " + std::to_string(chunk_size);
+        report(name, ns);
+        report(name + ", longest next", longest);
+    }
+
+    return 0;
+}
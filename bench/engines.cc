@@ -0,0 +1,65 @@
+#include <string>
+#include <vector>
+
+#include "bembo/arena.h"
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+// A `sep` of `n` short words, which is roughly `4 * n` nodes.
+Doc short_words(int n) {
+    std::vector<Doc> ws;
+    ws.reserve(n);
+    for (int i = 0; i < n; i++) {
+        ws.emplace_back(Doc::s("w" + std::to_string(i % 1000000)));
+    }
+    return bembo::sep(Doc::c(',') + Doc::softline(), ws);
+}
+
+// Groups nested `depth` deep without any indentation, so that the output stays linear in the size of the doc. When the
+// groups don't fit, the `Fits` engine takes exponential time to render this, as each trailing `softbreak` is rescanned
+// by the checks of all the groups that enclose it.
+Doc nested_groups(int depth) {
+    Doc res = Doc::c('x');
+    for (int i = 0; i < depth; i++) {
+        res = Doc::group(Doc::concat(Doc::c('('), Doc::softbreak(), res, Doc::softbreak(), Doc::c(')')));
+    }
+    return res;
+}
+
+void run(std::string_view name, const Doc &doc, Engine engine, double nodes, int cols = 80) {
+    auto ns = time_ns(1, [&] { doc.pretty(cols, engine); });
+    std::printf("%-40.*s %14.1f ns %8.2f ns/node\n", static_cast<int>(name.size()), name.data(), ns, ns / nodes);
+}
+
+} // namespace
+
+int main() {
+    for (int n = 1000; n <= 10000000; n *= 10) {
+        DocArena arena;
+        DocArena::Scope scope{arena};
+        auto doc = short_words(n / 4);
+        run("sep " + std::to_string(n) + " nodes fits", doc, Engine::Fits, n);
+        run("sep " + std::to_string(n) + " nodes linear", doc, Engine::Linear, n);
+    }
+
+    // Only small depths are feasible with `Fits`.
+    for (int depth : {8, 12, 16, 20}) {
+        auto doc = nested_groups(depth);
+        run("nested " + std::to_string(depth) + " fits", doc, Engine::Fits, depth * 6, 10);
+        run("nested " + std::to_string(depth) + " linear", doc, Engine::Linear, depth * 6, 10);
+    }
+
+    for (int n = 1000; n <= 10000000; n *= 10) {
+        DocArena arena;
+        DocArena::Scope scope{arena};
+        auto doc = nested_groups(n / 6);
+        run("nested " + std::to_string(n) + " nodes linear", doc, Engine::Linear, n, 10);
+    }
+
+    return 0;
+}
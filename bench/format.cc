@@ -0,0 +1,37 @@
+#include <cstdio>
+#include <string>
+
+#include "bembo/doc.h"
+#include "bembo/format.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+#ifdef __cpp_lib_format
+
+int main() {
+    auto doc = xml(4, 4);
+    std::string out;
+
+    report("format_to", time_ns(1000, [&] {
+               out.clear();
+               std::format_to(std::back_inserter(out), "log: {:80}\n", doc);
+           }));
+
+    report("pretty + format_to", time_ns(1000, [&] {
+               out.clear();
+               std::format_to(std::back_inserter(out), "log: {}\n", doc.pretty(80));
+           }));
+
+    return 0;
+}
+
+#else
+
+int main() {
+    std::printf("std::format is not available\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+// The peak resident set size of the process so far, in megabytes.
+long peak_mb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024;
+}
+
+} // namespace
+
+// Rendering a large result set whose rows are built as they're rendered, against building every row up front. The
+// generated rows run first, as the peak memory of the process only ever grows.
+int main() {
+    constexpr size_t rows = 1000000;
+    std::vector<std::pair<int, int>> data;
+    for (size_t i = 0; i < rows; i++) {
+        data.emplace_back(i, i * 7 % 1000);
+    }
+
+    auto row = [](const std::pair<int, int> &row) {
+        return Doc::group(Doc::nest(2, Doc::s("row") << Doc::s(std::to_string(row.first)) / Doc::s(std::to_string(row.second))));
+    };
+
+    std::printf("before rendering: %ld MB\n", peak_mb());
+
+    auto generated = generate_sep(Doc::line(), data.begin(), data.end(), row);
+    report("generate_sep pretty", time_ns(3, [&] { generated.pretty(80); }));
+    std::printf("after generate_sep: %ld MB\n", peak_mb());
+
+    report("sep build and pretty", time_ns(3, [&] {
+               std::vector<Doc> docs;
+               docs.reserve(rows);
+               for (auto &r : data) {
+                   docs.emplace_back(row(r));
+               }
+               sep(Doc::line(), docs).pretty(80);
+           }));
+    std::printf("after sep: %ld MB\n", peak_mb());
+
+    return 0;
+}
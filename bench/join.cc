@@ -0,0 +1,30 @@
+#include <span>
+#include <string>
+#include <vector>
+
+#include "bembo/doc.h"
+#include "bembo/parallel.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+int main() {
+    std::vector<Doc> docs;
+    docs.reserve(1000000);
+    for (int i = 0; i < 1000000; i++) {
+        docs.emplace_back(Doc::s(std::to_string(i)));
+    }
+
+    auto sep = Doc::c(',') + Doc::softline();
+
+    // The serial `join` builds a chain of concats as deep as the range is long, which can exhaust the stack when
+    // released, so it only gets a slice of the range.
+    report("join 10000", time_ns(3, [&] { bembo::join(std::span{docs}.first(10000)); }));
+    report("join 10000 par", time_ns(3, [&] { bembo::join(std::execution::par, std::span{docs}.first(10000)); }));
+    report("join 1000000 par", time_ns(3, [&] { bembo::join(std::execution::par, docs); }));
+    report("sep 1000000", time_ns(3, [&] { bembo::sep(sep, docs); }));
+    report("sep 1000000 par", time_ns(3, [&] { bembo::sep(std::execution::par, sep, docs); }));
+
+    return 0;
+}
@@ -0,0 +1,47 @@
+#include <array>
+#include <vector>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+// Previewing the start of a large doc, where most of it is cut off: building every subtree up front, against building
+// them as the renderer reaches them.
+int main() {
+    constexpr int items = 10000;
+    std::array<char, 4096> buf;
+
+    report("eager build and render_to", time_ns(10, [&] {
+               Doc doc;
+               for (int i = 0; i < items; i++) {
+                   doc += xml(3, 3) + Doc::line();
+               }
+               doc.render_to(buf, 80);
+           }));
+
+    report("lazy build and render_to", time_ns(10, [&] {
+               Doc doc;
+               for (int i = 0; i < items; i++) {
+                   doc += Doc::lazy([] { return xml(3, 3); }) + Doc::line();
+               }
+               doc.render_to(buf, 80);
+           }));
+
+    // With every subtree rendered, the thunks only add overhead.
+    std::vector<Doc> eager;
+    std::vector<Doc> lazy;
+    for (int i = 0; i < 1000; i++) {
+        eager.emplace_back(xml(3, 3));
+        lazy.emplace_back(Doc::lazy([doc = eager.back()] { return doc; }));
+    }
+    auto eager_doc = bembo::sep(Doc::line(), eager);
+    auto lazy_doc = bembo::sep(Doc::line(), lazy);
+    lazy_doc.pretty(80);
+
+    report("eager pretty", time_ns(10, [&] { eager_doc.pretty(80); }));
+    report("lazy pretty, already built", time_ns(10, [&] { lazy_doc.pretty(80); }));
+
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include <string>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+// Groups nested `depth` deep, where each level adds a pair of parens: `( ( ( x ) ) )`.
+Doc nested(int depth) {
+    Doc res = Doc::sv("x");
+    for (int i = 0; i < depth; i++) {
+        res = Doc::group(Doc::concat(Doc::c('('), Doc::line(), res, Doc::line(), Doc::c(')')));
+    }
+    return res;
+}
+
+} // namespace
+
+// Rendering with the line length set to the depth of the doc, so that the outer groups are broken and the inner ones are
+// flattened. Deciding each group requires measuring its flattened contents, up to the line length.
+int main() {
+    for (int depth : {500, 1000, 2000, 4000, 8000}) {
+        auto doc = nested(depth);
+        auto ns = time_ns(3, [&] { doc.pretty(depth); });
+        report("nested(" + std::to_string(depth) + ")", ns);
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "bembo/async_writer.h"
+#include "bembo/doc.h"
+#include "bembo/fd_writer.h"
+#include "bembo/mmap_writer.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+// About 100MB of output: lines of text that all share a single node, indented by a surrounding `nest`.
+Doc large_doc() {
+    auto text = Doc::s("the quick brown fox jumps over the lazy dog");
+    Doc body;
+    for (int i = 0; i < 2'000'000; i++) {
+        body += Doc::line();
+        body += text;
+    }
+    return Doc::concat(Doc::c('{'), Doc::nest(4, body), Doc::line(), Doc::c('}'));
+}
+
+template <typename Fn> void run(const std::string &name, const char *path, Fn &&render) {
+    auto ns = time_ns(3, [&] {
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        render(fd);
+        ::close(fd);
+    });
+    report(name, ns);
+}
+
+void run_all(const char *label, const char *path, const Doc &doc, bool mappable) {
+    RenderContext ctx;
+    std::string prefix = std::string{label} + ", ";
+
+    run(prefix + "fd", path, [&](int fd) {
+        FdWriter out{fd};
+        doc.render(ctx, out, 80);
+    });
+
+    run(prefix + "async", path, [&](int fd) {
+        AsyncWriter out{fd};
+        doc.render(ctx, out, 80);
+    });
+
+    if (mappable) {
+        run(prefix + "mmap", path, [&](int fd) {
+            MmapWriter out{fd};
+            doc.render(ctx, out, 80);
+        });
+    }
+
+    run(prefix + "stream", path, [&](int fd) {
+        std::ofstream file{path};
+        StreamWriter out{file};
+        doc.render(ctx, out, 80);
+    });
+
+    run(prefix + "string", path, [&](int fd) {
+        StringWriter out;
+        doc.render(ctx, out, 80);
+        auto rest = std::string_view{out.buffer};
+        while (!rest.empty()) {
+            auto n = ::write(fd, rest.data(), rest.size());
+            if (n <= 0) {
+                break;
+            }
+            rest.remove_prefix(n);
+        }
+    });
+}
+
+} // namespace
+
+int main() {
+    auto doc = large_doc();
+
+    run_all("/dev/null", "/dev/null", doc, false);
+    run_all("tmpfs", "/dev/shm/bembo-bench-output", doc, true);
+    ::unlink("/dev/shm/bembo-bench-output");
+    run_all("file", "/tmp/bembo-bench-output", doc, true);
+    ::unlink("/tmp/bembo-bench-output");
+    return 0;
+}
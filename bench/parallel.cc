@@ -0,0 +1,35 @@
+#include <algorithm>
+#include <string>
+#include <thread>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+int main() {
+    // A dump of many records, one after another at the top level.
+    Doc doc;
+    for (int i = 0; i < 2000; i++) {
+        doc += xml(3, 4) + Doc::line();
+    }
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        std::string suffix = engine == Engine::Fits ? " fits" : " linear";
+
+        report("sequential" + suffix, time_ns(3, [&] { doc.pretty(80, engine); }));
+
+        auto cores = std::max(1u, std::thread::hardware_concurrency());
+        // Powers of two up to the number of cores, and then the number of cores itself.
+        for (unsigned threads = 1;; threads = std::min(threads * 2, cores)) {
+            report("parallel " + std::to_string(threads) + " threads" + suffix,
+                   time_ns(3, [&] { doc.pretty_parallel(80, threads, engine); }));
+            if (threads == cores) {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
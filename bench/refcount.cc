@@ -0,0 +1,28 @@
+#include <vector>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+// Construction-only benchmarks, which are dominated by refcount traffic. Build both `//bench:refcount` and
+// `//bench:refcount_single_threaded` to compare the atomic and plain refcount policies.
+int main() {
+    report("xml(8, 4)", time_ns(10, [] { xml(8, 4); }));
+    report("words(100000)", time_ns(10, [] { words(100000); }));
+
+    std::vector<Doc> docs;
+    for (int i = 0; i < 100000; i++) {
+        docs.emplace_back(Doc::s("element " + std::to_string(i)));
+    }
+
+    report("join(100000)", time_ns(10, [&] { bembo::join(docs); }));
+    report("group(100000)", time_ns(10, [&] {
+               for (auto &doc : docs) {
+                   Doc::group(doc + Doc::softline());
+               }
+           }));
+
+    return 0;
+}
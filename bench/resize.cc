@@ -0,0 +1,47 @@
+#include <optional>
+#include <string>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+// Render once for each width a terminal passes through while it's resized from 80 to 120 columns.
+template <typename Fn> double resize_ns(Fn &&render) {
+    return time_ns(1, [&] {
+               for (int cols = 80; cols <= 120; cols++) {
+                   render(cols);
+               }
+           }) /
+           41;
+}
+
+} // namespace
+
+int main() {
+    auto doc = xml(7, 4);
+    RenderContext ctx;
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        std::string suffix = engine == Engine::Fits ? " fits" : " linear";
+
+        report("render per resize" + suffix, resize_ns([&](int cols) {
+                   StringWriter out;
+                   doc.render(ctx, out, cols, engine);
+               }));
+
+        std::optional<Layout> layout;
+        report("build layout 40..200" + suffix, time_ns(1, [&] { layout.emplace(doc, 40, 200, engine); }));
+        std::printf("%-40s %14zu layouts\n", ("layout 40..200" + suffix).c_str(), layout->size());
+
+        report("layout render per resize" + suffix, resize_ns([&](int cols) {
+                   StringWriter out;
+                   layout->render(ctx, out, cols);
+               }));
+    }
+
+    return 0;
+}
@@ -0,0 +1,35 @@
+#include <array>
+#include <string>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+int main() {
+    auto doc = xml(7, 4);
+    std::array<int, 3> widths{40, 80, 120};
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        std::string suffix = engine == Engine::Fits ? " fits" : " linear";
+
+        report("pretty each width" + suffix, time_ns(5, [&] {
+                   for (auto cols : widths) {
+                       doc.pretty(cols, engine);
+                   }
+               }));
+        report("pretty all widths" + suffix, time_ns(5, [&] { doc.pretty(widths, engine); }));
+
+        report("measure each width" + suffix, time_ns(5, [&] {
+                   for (auto cols : widths) {
+                       doc.measure(cols, engine);
+                   }
+               }));
+        report("measure all widths" + suffix, time_ns(5, [&] { doc.measure(widths, engine); }));
+    }
+
+    report("min_width(1000)", time_ns(5, [&] { doc.min_width(1000); }));
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "bembo/doc.h"
+#include "bench/bench.h"
+
+using namespace bembo;
+using namespace bembo::bench;
+
+namespace {
+
+// Nested lists of single characters, so that nearly every write is a one byte `ShortText`.
+Doc chars(int depth, int breadth) {
+    std::vector<Doc> children;
+    children.reserve(breadth);
+    for (int i = 0; i < breadth; i++) {
+        children.emplace_back(depth == 0 ? Doc::c('a' + i % 26) : chars(depth - 1, breadth));
+    }
+
+    return Doc::group(Doc::brackets(Doc::nest(1, bembo::sep(Doc::c(',') + Doc::softline(), children))));
+}
+
+} // namespace
+
+int main() {
+    auto doc = chars(5, 10);
+    RenderContext ctx;
+
+    {
+        StringWriter out;
+        report("string, concrete", time_ns(20, [&] {
+                   out.buffer.clear();
+                   doc.render(ctx, out, 80, Engine::Linear);
+               }));
+    }
+
+    {
+        StringWriter out;
+        Writer &writer = out;
+        report("string, virtual", time_ns(20, [&] {
+                   out.buffer.clear();
+                   doc.render(ctx, writer, 80, Engine::Linear);
+               }));
+    }
+
+    {
+        std::ostringstream stream;
+        StreamWriter out{stream};
+        report("stream, concrete", time_ns(20, [&] {
+                   stream.str({});
+                   doc.render(ctx, out, 80, Engine::Linear);
+               }));
+    }
+
+    {
+        std::ostringstream stream;
+        StreamWriter out{stream};
+        Writer &writer = out;
+        report("stream, virtual", time_ns(20, [&] {
+                   stream.str({});
+                   doc.render(ctx, writer, 80, Engine::Linear);
+               }));
+    }
+
+    // Flushing a file stream is a syscall, so compare flushing every line against flushing once at the end.
+    for (auto mode : {StreamWriter::Flush::Line, StreamWriter::Flush::End}) {
+        std::ofstream file{"/dev/null"};
+        StreamWriter out{file, mode};
+        report(mode == StreamWriter::Flush::Line ? "file, flush lines" : "file, flush end",
+               time_ns(20, [&] { doc.render(ctx, out, 80, Engine::Linear); }));
+    }
+
+    return 0;
+}
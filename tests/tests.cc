@@ -1,9 +1,21 @@
 #include "doctest/doctest.h"
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdio>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
+#include "bembo/arena.h"
+#include "bembo/async_writer.h"
 #include "bembo/doc.h"
+#include "bembo/fd_writer.h"
+#include "bembo/format.h"
+#include "bembo/mmap_writer.h"
+#include "bembo/parallel.h"
 
 using namespace std::literals::string_literals;
 using namespace std::literals::string_view_literals;
@@ -65,6 +77,24 @@ TEST_CASE("softline") {
     check_pretty("a b\nc", bembo::sep(Doc::softline(), docs), 3);
 }
 
+TEST_CASE("constants") {
+    using namespace bembo::literals;
+
+    constexpr Doc open = "<"_doc;
+    constexpr Doc arrow = Doc::lit("->");
+    check_pretty("<->>", Doc::concat(open, arrow, Doc::c('>')));
+    check_pretty("a longer literal", "a longer literal"_doc);
+
+    {
+        DocArena arena;
+        DocArena::Scope scope{arena};
+        check_pretty("a\nb", Doc::concat("a", Doc::softbreak(), "b"), 1);
+    }
+
+    check_pretty("ab", Doc::concat("a", Doc::softbreak(), "b"));
+    check_pretty("a b", Doc::concat("a", Doc::softline(), "b"));
+}
+
 TEST_CASE("stream output") {
     std::array<Doc, 3> docs{Doc::sv("a"), Doc::sv("b"), Doc::sv("c")};
 
@@ -95,6 +125,204 @@ TEST_CASE("stream output") {
         bembo::sep(Doc::c(',') + Doc::softline(), docs).render(res, 5);
         CHECK_EQ("a, b,\nc", out.str());
     }
+
+    {
+        std::stringstream out;
+        StreamWriter res{out};
+        auto doc = Doc::c('a') + Doc::nest(100, Doc::line() + Doc::c('b'));
+        doc.render(res, 80);
+        CHECK_EQ("a\n" + std::string(100, ' ') + "b", out.str());
+    }
+}
+
+namespace {
+
+struct SyncCounter : std::stringbuf {
+    int syncs = 0;
+
+    int sync() override {
+        this->syncs++;
+        return std::stringbuf::sync();
+    }
+};
+
+} // namespace
+
+TEST_CASE("stream flushing") {
+    auto doc = Doc::vcat(Doc::c('a'), Doc::c('b'), Doc::c('c'));
+
+    {
+        SyncCounter buf;
+        std::ostream out{&buf};
+        StreamWriter res{out};
+        doc.render(res, 80);
+        CHECK_EQ("a\nb\nc", buf.str());
+        CHECK_EQ(1, buf.syncs);
+    }
+
+    {
+        SyncCounter buf;
+        std::ostream out{&buf};
+        StreamWriter res{out, StreamWriter::Flush::Line};
+        doc.render(res, 80);
+        CHECK_EQ("a\nb\nc", buf.str());
+        CHECK_EQ(3, buf.syncs);
+    }
+}
+
+namespace {
+
+std::string read_all(std::FILE *file) {
+    std::string res;
+    std::rewind(file);
+    char buf[4096];
+    while (auto n = std::fread(buf, 1, sizeof(buf), file)) {
+        res.append(buf, n);
+    }
+    return res;
+}
+
+} // namespace
+
+TEST_CASE("render to buffer") {
+    auto doc = Doc::nest(2, Doc::sv("hello") / Doc::sv("world"));
+
+    {
+        std::array<char, 32> buf;
+        auto res = doc.render_to(buf, 80);
+        CHECK_EQ(13, res.size);
+        CHECK(!res.truncated);
+        CHECK_EQ("hello\n  world", std::string_view(buf.data(), res.size));
+    }
+
+    {
+        std::array<char, 13> buf;
+        auto res = doc.render_to(buf, 80);
+        CHECK_EQ(13, res.size);
+        CHECK(!res.truncated);
+    }
+
+    {
+        std::array<char, 7> buf;
+        auto res = doc.render_to(buf, 80);
+        CHECK_EQ(7, res.size);
+        CHECK(res.truncated);
+        CHECK_EQ("hello\n ", std::string_view(buf.data(), res.size));
+    }
+
+    std::string out;
+    Doc::s(std::string(100, 'x')).pretty_into(out, 80);
+    CHECK_EQ(std::string(100, 'x'), out);
+
+    auto *data = out.data();
+    doc.pretty_into(out, 80);
+    CHECK_EQ("hello\n  world", out);
+    CHECK_EQ(data, out.data());
+}
+
+#ifdef __cpp_lib_format
+
+TEST_CASE("format") {
+    auto doc = Doc::nest(2, Doc::sv("hello") / Doc::group(Doc::sv("a") + Doc::softline() + Doc::sv("b")));
+    CHECK_EQ("hello\n  a b", std::format("{}", doc));
+    CHECK_EQ("hello\n  a\n  b", std::format("{:3}", doc));
+    CHECK_EQ("<hello\n  a b>", std::format("<{:80}>", doc));
+    CHECK_EQ("hello\n  a b", std::vformat("{:2147483647}", std::make_format_args(doc)));
+    CHECK_THROWS_AS(std::vformat("{:2147483648}", std::make_format_args(doc)), std::format_error);
+    CHECK_THROWS_AS(std::vformat("{:99999999999}", std::make_format_args(doc)), std::format_error);
+}
+
+#endif
+
+TEST_CASE("fd writer") {
+    std::vector<Doc> docs;
+    std::string expected;
+    for (int i = 0; i < 3000; i++) {
+        docs.emplace_back(Doc::s(std::to_string(i)));
+        expected += (i == 0 ? "" : i % 10 == 0 ? "\n  " : ",") + std::to_string(i);
+    }
+
+    Doc doc;
+    for (int i = 0; i < 3000; i++) {
+        if (i > 0) {
+            doc += i % 10 == 0 ? Doc::nest(2, Doc::line()) : Doc::c(',');
+        }
+        doc += docs[i];
+    }
+
+    auto *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    FdWriter out{fileno(file)};
+    doc.render(out, 80);
+    CHECK_EQ(0, out.error());
+    CHECK_EQ(expected, read_all(file));
+
+    std::fclose(file);
+}
+
+TEST_CASE("mmap writer") {
+    std::vector<Doc> lines;
+    for (int i = 0; i < 1000; i++) {
+        lines.emplace_back(Doc::s("line " + std::to_string(i)));
+    }
+    auto doc = Doc::nest(2, Doc::c('{') / bembo::sep(Doc::line(), lines)) / Doc::c('}');
+    auto expected = doc.pretty(80);
+
+    auto *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    {
+        // A small chunk size to make the writer grow the file several times.
+        MmapWriter out{fileno(file), 4096};
+        doc.render(out, 80);
+        CHECK_EQ(0, out.error());
+        CHECK_EQ(expected, read_all(file));
+
+        // Later renders continue where the last one finished.
+        Doc::c('!').render(out, 80);
+        CHECK_EQ(expected + "!", read_all(file));
+    }
+
+    CHECK_EQ(expected + "!", read_all(file));
+    std::fclose(file);
+}
+
+TEST_CASE("mmap writer empty") {
+    auto *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+    std::fputs("old contents", file);
+    std::fflush(file);
+
+    // Rendering nothing still replaces what was in the file.
+    MmapWriter out{fileno(file), 4096};
+    Doc::nil().render(out, 80);
+    CHECK_EQ(0, out.error());
+    CHECK_EQ("", read_all(file));
+
+    std::fclose(file);
+}
+
+TEST_CASE("async writer") {
+    std::vector<Doc> lines;
+    for (int i = 0; i < 1000; i++) {
+        lines.emplace_back(Doc::s("line " + std::to_string(i)));
+    }
+    auto doc = Doc::nest(2, Doc::c('{') / bembo::sep(Doc::line(), lines)) / Doc::c('}');
+    auto expected = doc.pretty(80);
+
+    auto *file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    {
+        // Small buffers and a single buffer in flight, so that rendering has to wait on the background thread.
+        AsyncWriter out{fileno(file), 64, 1};
+        doc.render(out, 80);
+        CHECK_EQ(0, out.error());
+        CHECK_EQ(expected, read_all(file));
+    }
+
+    std::fclose(file);
 }
 
 Doc tag(std::string_view name, Doc body = Doc::nil()) {
@@ -118,6 +346,667 @@ TEST_CASE("xml") {
     check_pretty("<a>\n  <b>\n    <c />\n  </b>\n</a>", tag("a", tag("b", tag("c"))), 2);
 }
 
+TEST_CASE("linear engine") {
+    std::array<Doc, 3> docs{Doc::sv("a"), Doc::sv("b"), Doc::sv("c")};
+    auto d = Doc::sv("hello");
+    auto softline = bembo::sep(Doc::softline(), docs);
+    auto ab = tag("a", tag("b"));
+
+    CHECK_EQ("hello hello", (d + Doc::softline() + d).pretty(80, Engine::Linear));
+    CHECK_EQ("hello\nhello", (d + Doc::softline() + d).pretty(5, Engine::Linear));
+    CHECK_EQ("a b c", softline.pretty(80, Engine::Linear));
+    CHECK_EQ("a\nb\nc", softline.pretty(2, Engine::Linear));
+    CHECK_EQ("a b\nc", softline.pretty(3, Engine::Linear));
+    CHECK_EQ("<a><b /></a>", ab.pretty(80, Engine::Linear));
+    CHECK_EQ("<a>\n  <b />\n</a>", ab.pretty(6, Engine::Linear));
+    CHECK_EQ("<a>\n  <b>\n    <c />\n  </b>\n</a>", tag("a", tag("b", tag("c"))).pretty(2, Engine::Linear));
+
+    // `Fits` breaks the first group, as the second only fits if it's broken as well.
+    CHECK_EQ("a\nb c", softline.pretty(4));
+    CHECK_EQ("a b\nc", softline.pretty(4, Engine::Linear));
+
+    // A flattened doc never breaks, however it's nested.
+    auto fl = Doc::flatten(Doc::s("c") / Doc::s("dddddddddd"));
+    auto group = Doc::group(Doc::s("aaaa") / Doc::s("bbbb"));
+    for (int width = 10; width <= 22; width++) {
+        CHECK_EQ((group + fl + Doc::s("e")).pretty(width), (group + (fl + Doc::s("e"))).pretty(width, Engine::Linear));
+        CHECK_EQ((group + fl + Doc::s("e")).pretty(width), (group + fl + Doc::s("e")).pretty(width, Engine::Linear));
+    }
+}
+
+TEST_CASE("render context") {
+    RenderContext ctx;
+    auto doc = tag("a", tag("b", tag("c")) + tag("d"));
+
+    for (int cols = 0; cols <= 20; cols++) {
+        for (auto engine : {Engine::Fits, Engine::Linear}) {
+            StringWriter out;
+            doc.render(ctx, out, cols, engine);
+            CHECK_EQ(doc.pretty(cols, engine), out.buffer);
+        }
+    }
+}
+
+TEST_CASE("measure") {
+    auto doc = tag("a", tag("b", tag("c")) + tag("d"));
+
+    for (int cols = 0; cols <= 30; cols++) {
+        for (auto engine : {Engine::Fits, Engine::Linear}) {
+            auto out = doc.pretty(cols, engine);
+            auto m = doc.measure(cols, engine);
+            CHECK_EQ(out.size(), m.bytes);
+            CHECK_EQ(static_cast<size_t>(std::count(out.begin(), out.end(), '\n')) + 1, m.lines);
+        }
+    }
+
+    auto m = doc.measure(8);
+    CHECK_EQ(4, m.lines);
+    CHECK_EQ(11, m.max_width);
+    CHECK_EQ(2, m.overflowing);
+
+    m = Doc::nil().measure(80);
+    CHECK_EQ(1, m.lines);
+    CHECK_EQ(0, m.max_width);
+    CHECK_EQ(0, m.bytes);
+}
+
+TEST_CASE("many widths") {
+    auto doc = tag("a", tag("b", tag("c")) + tag("d"));
+
+    std::vector<int> widths;
+    for (int cols = 30; cols >= 0; cols--) {
+        widths.push_back(cols);
+    }
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        auto rendered = doc.pretty(widths, engine);
+        auto measured = doc.measure(widths, engine);
+        REQUIRE(rendered.size() == widths.size());
+        REQUIRE(measured.size() == widths.size());
+
+        for (size_t i = 0; i < widths.size(); i++) {
+            CHECK_EQ(doc.pretty(widths[i], engine), rendered[i]);
+
+            auto m = doc.measure(widths[i], engine);
+            CHECK_EQ(m.lines, measured[i].lines);
+            CHECK_EQ(m.max_width, measured[i].max_width);
+            CHECK_EQ(m.bytes, measured[i].bytes);
+            CHECK_EQ(m.overflowing, measured[i].overflowing);
+        }
+    }
+
+    CHECK_EQ(std::optional<int>{24}, doc.min_width(1));
+    CHECK_EQ(std::optional<int>{15}, doc.min_width(3));
+    CHECK_EQ(std::optional<int>{11}, doc.min_width(4));
+    CHECK_EQ(std::optional<int>{11}, doc.min_width(100));
+    CHECK_EQ(0, doc.measure(11).overflowing);
+    CHECK_EQ(std::optional<int>{23}, Doc::s("a-long-unbreakable-word").min_width(1));
+    CHECK_EQ(std::nullopt, (Doc::sv("a") + Doc::line() + Doc::sv("b")).min_width(1));
+
+    // Lazy and generated docs count towards the width of the doc once they're built.
+    auto lines = [] { return Doc::s("alpha") / Doc::s("beta") / Doc::s("gamma"); };
+    CHECK_EQ(std::optional<int>{16}, Doc::group(lines()).min_width(1));
+    CHECK_EQ(std::optional<int>{16}, Doc::group(Doc::lazy(lines)).min_width(1));
+    CHECK_EQ(std::optional<int>{16}, Doc::group(Doc::generate(1, [&lines](size_t) { return lines(); })).min_width(1));
+    CHECK_EQ(Doc::group(lines()).min_width(100), Doc::group(Doc::lazy(lines)).min_width(100));
+    CHECK_EQ(std::optional<int>{5}, Doc::group(Doc::lazy(lines)).min_width(100));
+}
+
+TEST_CASE("layout") {
+    std::vector<Doc> words;
+    for (int i = 0; i < 20; i++) {
+        words.emplace_back(Doc::s(std::string(i % 5 + 1, 'w')));
+    }
+    auto para = bembo::sep(Doc::softline(), words);
+    auto doc = tag("a", tag("b", para) + tag("c", tag("d")) + para);
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        Layout layout{doc, 10, 120, engine};
+        CHECK(layout.size() > 1);
+
+        for (int cols = 0; cols <= 130; cols++) {
+            CHECK_EQ(doc.pretty(cols, engine), layout.pretty(cols));
+        }
+    }
+
+    Layout empty{doc, 10, 0};
+    CHECK_EQ(0, empty.size());
+    CHECK_EQ(doc.pretty(40), empty.pretty(40));
+
+    // A choice within a doc that fits on a line is still decided when the layout is replayed.
+    auto single =
+        Doc::group(Doc::s("abc")) + Doc::group(Doc::s("xx") / Doc::s("yy")) + Doc::group(Doc::s("p") / Doc::s("q"));
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        Layout layout{single, 0, 20, engine};
+        for (int cols = 0; cols <= 20; cols++) {
+            CHECK_EQ(single.pretty(cols, engine), layout.pretty(cols));
+        }
+    }
+
+    Layout at{single, 5};
+    CHECK_EQ("abcxx\nyyp q", at.pretty(5));
+    CHECK_EQ(single.pretty(5), at.pretty(5));
+}
+
+TEST_CASE("layout emission") {
+    auto doc = tag("a", tag("b", tag("c")) + tag("d"));
+    auto expected = doc.pretty(8);
+
+    Layout layout{doc, 8};
+    CHECK_EQ(1, layout.size());
+
+    StringWriter str;
+    layout.render(str, 8);
+    CHECK_EQ(expected, str.buffer);
+
+    std::ostringstream stream;
+    StreamWriter out{stream};
+    layout.render(out, 8);
+    CHECK_EQ(expected, stream.str());
+
+    std::string other;
+    std::thread worker{[&] { other = layout.pretty(8); }};
+    worker.join();
+    CHECK_EQ(expected, other);
+}
+
+TEST_CASE("parallel") {
+    std::vector<Doc> words;
+    for (int i = 0; i < 10; i++) {
+        words.emplace_back(Doc::s(std::string(i % 5 + 1, 'w')));
+    }
+    auto para = bembo::sep(Doc::softline(), words);
+
+    Doc doc;
+    for (int i = 0; i < 200; i++) {
+        auto record = tag("r", Doc::s(std::to_string(i)) + Doc::softline() + para);
+        if (i % 3 == 0) {
+            doc /= Doc::nest(2, Doc::sv("nested") / record);
+        } else {
+            doc += record + Doc::line();
+        }
+    }
+
+    auto expected_40 = doc.pretty(40);
+    for (int cols : {10, 40, 80}) {
+        for (auto engine : {Engine::Fits, Engine::Linear}) {
+            auto expected = doc.pretty(cols, engine);
+            for (size_t threads : {1, 2, 4, 7}) {
+                CHECK_EQ(expected, doc.pretty_parallel(cols, threads, engine));
+            }
+        }
+    }
+
+    CHECK_EQ(para.pretty(10), para.pretty_parallel(10, 4));
+
+    // The checks of `Fits` look past the end of a group into the docs that follow it at the top level, which have to
+    // be the same on every thread.
+    auto group = [](const char *a, const char *b) { return Doc::group(Doc::s(a) / Doc::s(b)); };
+    auto trailing = Doc::concat(group("aaaa", "b"), group("cc", "dd") + Doc::s("eeeeee"), Doc::line(), Doc::s("y"));
+    for (int cols = 8; cols <= 18; cols++) {
+        CHECK_EQ(trailing.pretty(cols), trailing.pretty_parallel(cols, 4));
+    }
+
+    // Line breaks are passed on to the writer as line breaks.
+    struct LineCounter final : Writer {
+        size_t lines = 0;
+        std::string text;
+
+        void line(int) override {
+            this->lines++;
+        }
+
+        void write(std::string_view sv) override {
+            this->text.append(sv);
+        }
+    };
+    LineCounter counter;
+    doc.render_parallel(counter, 40, 4);
+    CHECK_EQ(static_cast<size_t>(std::count(expected_40.begin(), expected_40.end(), '\n')), counter.lines);
+    CHECK_EQ(std::string::npos, counter.text.find('\n'));
+}
+
+namespace {
+
+// A doc of random groups, nesting and line breaks, `depth` levels deep.
+Doc random_doc(std::mt19937 &rng, int depth) {
+    auto pick = std::uniform_int_distribution<int>{0, depth > 0 ? 7 : 2}(rng);
+    switch (pick) {
+    case 0:
+        return Doc::s(std::string(std::uniform_int_distribution<size_t>{1, 6}(rng), 'a' + depth));
+    case 1:
+        return Doc::line();
+    case 2:
+        return Doc::softline();
+    case 3:
+        return Doc::group(random_doc(rng, depth - 1));
+    case 4:
+        return Doc::nest(2, random_doc(rng, depth - 1));
+    case 5:
+        return Doc::flatten(random_doc(rng, depth - 1));
+    default: {
+        Doc res;
+        auto n = std::uniform_int_distribution<int>{2, 5}(rng);
+        for (int i = 0; i < n; i++) {
+            res += random_doc(rng, depth - 1);
+        }
+        return res;
+    }
+    }
+}
+
+} // namespace
+
+TEST_CASE("parallel random") {
+    std::mt19937 rng{42};
+    for (int i = 0; i < 200; i++) {
+        auto doc = random_doc(rng, 6);
+        for (int cols : {4, 10, 20, 40}) {
+            for (auto engine : {Engine::Fits, Engine::Linear}) {
+                CHECK_EQ(doc.pretty(cols, engine), doc.pretty_parallel(cols, 3, engine));
+            }
+        }
+    }
+}
+
+TEST_CASE("render batch") {
+    std::vector<Doc> docs;
+    for (int i = 0; i < 100; i++) {
+        docs.emplace_back(i % 10 == 0 ? Doc::nil() : tag("a", tag("b", Doc::s(std::to_string(i))) + tag("c")));
+    }
+
+    for (size_t threads : {1, 3, 8}) {
+        auto batch = render_batch(docs, 12, threads);
+        REQUIRE(batch.size() == docs.size());
+
+        std::string text;
+        for (size_t i = 0; i < docs.size(); i++) {
+            CHECK_EQ(docs[i].pretty(12), batch[i]);
+            text += docs[i].pretty(12);
+        }
+        CHECK_EQ(text, batch.text);
+    }
+
+    auto empty = render_batch({}, 80, 4);
+    CHECK_EQ(0, empty.size());
+    CHECK_EQ("", empty.text);
+
+    // The worker threads are shared, so batches may be rendered from several threads at once, and from within a batch.
+    auto expected = render_batch(docs, 12, 1).text;
+    std::vector<Doc> nested;
+    for (int i = 0; i < 8; i++) {
+        nested.emplace_back(Doc::lazy([&docs] { return Doc::s(render_batch(docs, 12, 4).text); }));
+    }
+
+    std::vector<std::thread> threads;
+    std::atomic<int> matched{0};
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([&] {
+            if (render_batch(docs, 12, 4).text == expected) {
+                matched++;
+            }
+        });
+    }
+    auto outer = render_batch(nested, 12, 4);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(4, matched.load());
+    for (size_t i = 0; i < nested.size(); i++) {
+        CHECK_EQ(expected, outer[i]);
+    }
+}
+
+TEST_CASE("parallel construction") {
+    std::vector<Doc> docs;
+    for (int i = 0; i < 10000; i++) {
+        docs.emplace_back(Doc::s(std::to_string(i)));
+    }
+
+    auto joined = bembo::join(std::execution::par, docs);
+    CHECK_EQ(bembo::join(docs).pretty(80), joined.pretty(80));
+
+    auto sep = Doc::c(',') + Doc::softline();
+    auto separated = bembo::sep(std::execution::par, sep, docs);
+    for (int cols : {5, 80}) {
+        CHECK_EQ(bembo::sep(sep, docs).pretty(cols), separated.pretty(cols));
+    }
+
+    std::vector<Doc> none;
+    CHECK(bembo::join(std::execution::par, none).is_nil());
+    CHECK(bembo::sep(std::execution::seq, sep, none).is_nil());
+    CHECK_EQ("a", bembo::sep(std::execution::par, sep, std::array<Doc, 1>{Doc::c('a')}).pretty(80));
+}
+
+TEST_CASE("lazy") {
+    std::atomic<int> built{0};
+    auto item = [](int i) { return Doc::group(Doc::s("item") << Doc::s(std::to_string(i)) / Doc::s("done")); };
+    auto lazy = [&built, &item](int i) {
+        return Doc::lazy([&built, &item, i] {
+            built++;
+            return item(i);
+        });
+    };
+
+    Doc doc;
+    Doc eager;
+    for (int i = 0; i < 100; i++) {
+        doc += lazy(i) + Doc::line();
+        eager += item(i) + Doc::line();
+    }
+
+    // Only the docs that were reached before the buffer filled up are built.
+    std::array<char, 16> buf;
+    auto res = doc.render_to(buf, 80);
+    CHECK(res.truncated);
+    CHECK_EQ("item 0 done\nitem", std::string_view(buf.data(), res.size));
+    CHECK_EQ(2, built.load());
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        for (int cols : {5, 80}) {
+            CHECK_EQ(eager.pretty(cols, engine), doc.pretty(cols, engine));
+        }
+    }
+    CHECK_EQ(100, built.load());
+    CHECK_EQ(eager.pretty(8), doc.pretty_parallel(8, 4));
+
+    // The lookahead for a group only builds the docs it reaches before deciding, up to the next line break.
+    struct Counting final : Writer {
+        std::atomic<int> &built;
+        std::vector<int> seen;
+
+        explicit Counting(std::atomic<int> &built) : built{built} {}
+
+        void line(int indent) override {
+            this->seen.push_back(this->built.load());
+        }
+
+        void write(std::string_view sv) override {}
+    };
+
+    built = 0;
+    Counting out{built};
+    auto group = Doc::group(Doc::s("text") / lazy(0)) + lazy(1) + Doc::line() + lazy(2) + Doc::line();
+    group.render(out, 80);
+    CHECK_EQ((std::vector<int>{2, 3}), out.seen);
+
+    // Lazy docs may be nested, flattened, and render docs of their own while they're built.
+    auto nested = Doc::group(Doc::s("a") / Doc::lazy([] { return Doc::s(Doc::c('b').pretty(80)) / Doc::lazy([] {
+        return Doc::c('c');
+    }); }));
+    CHECK_EQ("a b c", nested.pretty(80));
+    CHECK_EQ("a\nb\nc", nested.pretty(3));
+    CHECK_EQ("a b c", Doc::flatten(nested).pretty(1));
+
+    // Each lazy doc is measured once, however many lazy docs it's nested within. Every walk of the chain reaches the
+    // generated doc at its end, which counts how often that happens.
+    int reached = 0;
+    Doc chain = Doc::generate(1, [&reached](size_t) {
+        reached++;
+        return Doc::s("end");
+    });
+    for (int i = 0; i < 2000; i++) {
+        chain = Doc::lazy([inner = chain] { return Doc::s("x") + inner; });
+    }
+    StringWriter chained;
+    Doc::group(chain).render(chained, 80, Engine::Linear);
+    CHECK_EQ(std::string(2000, 'x') + "end", chained.buffer);
+    CHECK(reached < 10);
+
+    // Lazy docs are built in the heap, even when they're held by docs in an arena.
+    DocArena arena;
+    Doc held;
+    {
+        DocArena::Scope scope{arena};
+        held = Doc::s("held") + Doc::lazy([] {
+            CHECK_EQ(nullptr, DocArena::current());
+            return Doc::s(" in the heap");
+        });
+    }
+    {
+        DocArena other;
+        DocArena::Scope scope{other};
+        CHECK_EQ("held in the heap", held.pretty(80));
+    }
+    CHECK_EQ("held in the heap", held.pretty(80));
+}
+
+TEST_CASE("generate") {
+    std::vector<std::string> rows;
+    std::vector<Doc> eager;
+    for (int i = 0; i < 200; i++) {
+        rows.push_back("row " + std::to_string(i));
+        eager.emplace_back(Doc::s(rows.back()));
+    }
+
+    auto comma = Doc::c(',') + Doc::softline();
+    auto expected = tag("rows", bembo::sep(comma, eager));
+    auto generated = tag("rows", bembo::generate_sep(comma, rows.begin(), rows.end(), [](auto &row) {
+        return Doc::s(row);
+    }));
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        for (int cols : {5, 20, 80, 10000}) {
+            CHECK_EQ(expected.pretty(cols, engine), generated.pretty(cols, engine));
+            CHECK_EQ(Doc::group(expected).pretty(cols, engine), Doc::group(generated).pretty(cols, engine));
+        }
+    }
+
+    std::array<int, 3> widths{10, 40, 100};
+    CHECK_EQ(expected.pretty(widths), generated.pretty(widths));
+    CHECK_EQ(Layout(expected, 10, 60).pretty(33), Layout(generated, 10, 60).pretty(33));
+    CHECK_EQ(expected.pretty(30), generated.pretty_parallel(30, 4));
+
+    auto nested = Doc::generate(3, [&rows](size_t i) {
+        return Doc::line() + Doc::nest(2, bembo::generate(rows.begin(), rows.begin() + i + 1, [](auto &row) {
+            return Doc::line() + Doc::s(row);
+        }));
+    });
+    CHECK_EQ("\n\n  row 0\n\n  row 0\n  row 1\n\n  row 0\n  row 1\n  row 2", nested.pretty(80));
+
+    // Generated docs may render docs of their own while they're built.
+    auto rendering = Doc::generate(3, [](size_t i) {
+        return Doc::s(Doc::group(Doc::s("a") / Doc::c(static_cast<char>('b' + i))).pretty(80)) + Doc::line();
+    });
+    auto around = Doc::s("head") + Doc::nest(2, Doc::line() + rendering) + Doc::s("tail");
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        CHECK_EQ("head\n  a b\n  a c\n  a d\n  tail", around.pretty(80, engine));
+    }
+    CHECK(Doc::generate(0, [](size_t i) { return Doc::c('a'); }).is_nil());
+
+    // Only the docs around the current position are held while rendering.
+    struct Live {
+        int &count;
+
+        explicit Live(int &count) : count{count} {
+            this->count++;
+        }
+
+        Live(const Live &other) : count{other.count} {
+            this->count++;
+        }
+
+        ~Live() {
+            this->count--;
+        }
+    };
+
+    struct Peak final : Writer {
+        int &live;
+        int peak{0};
+
+        explicit Peak(int &live) : live{live} {}
+
+        void line(int indent) override {
+            this->peak = std::max(this->peak, this->live);
+        }
+
+        void write(std::string_view sv) override {}
+    };
+
+    int live = 0;
+    int made = 0;
+    auto lines = Doc::generate(100000, [&live, &made](size_t i) {
+        made++;
+        // The doc holds on to a `Live` until it's released.
+        return Doc::generate(1, [held = Live{live}, i](size_t) { return Doc::s(std::to_string(i)) + Doc::line(); });
+    });
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        Peak out{live};
+        lines.render(out, 80, engine);
+        CHECK(out.peak <= 2);
+        CHECK_EQ(0, live);
+    }
+
+    // Rendering stops early once the buffer is full, releasing the docs it generated.
+    made = 0;
+    std::array<char, 8> buf;
+    lines.render_to(buf, 80);
+    CHECK(made <= 8);
+    CHECK_EQ(0, live);
+
+    // The linear engine only generates the docs up to the next line break to measure what's ahead, however deeply the
+    // sequence is nested, so each doc is generated about twice rather than once more for every enclosing node.
+    made = 0;
+    auto counted = Doc::generate(1000, [&made](size_t i) {
+        made++;
+        return Doc::s(std::to_string(i)) + Doc::line();
+    });
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        made = 0;
+        StringWriter out;
+        Doc::nest(2, Doc::nest(2, Doc::nest(2, counted))).render(out, 80, engine);
+        CHECK(made <= (engine == Engine::Fits ? 1000 : 2100));
+    }
+
+    // Without any line breaks, the rest of the sequence is measured by what's been split off, rather than again.
+    auto words = Doc::generate(4000, [&made](size_t i) {
+        made++;
+        return Doc::s("w" + std::to_string(i % 10));
+    });
+    for (auto &doc : {words, Doc::nest(2, words + Doc::line() + words)}) {
+        made = 0;
+        StringWriter out;
+        doc.render(out, 80, Engine::Linear);
+        CHECK(made <= 8 * 4000);
+        CHECK_EQ(doc.pretty(80, Engine::Linear), out.buffer);
+    }
+
+    // Writers that hold on to the text they're given keep it past the release of the doc it came from.
+    auto items = Doc::generate(200, [](size_t i) { return Doc::s("item-number-" + std::to_string(i)) + Doc::line(); });
+    auto wide = Doc::generate(100, [](size_t i) { return Doc::s(std::string(2000, 'a' + i % 26)) + Doc::line(); });
+    for (auto &doc : {items, wide}) {
+        auto *file = std::tmpfile();
+        REQUIRE(file != nullptr);
+        {
+            FdWriter out{fileno(file)};
+            doc.render(out, 80);
+            CHECK_EQ(0, out.error());
+        }
+        CHECK_EQ(doc.pretty(80), read_all(file));
+        std::fclose(file);
+    }
+}
+
+TEST_CASE("chunked") {
+    std::vector<Doc> items;
+    for (int i = 0; i < 50; i++) {
+        items.emplace_back(tag("item", Doc::s(std::to_string(i))));
+    }
+    auto doc = tag("items", bembo::sep(Doc::c(',') + Doc::softline(), items));
+
+    for (auto engine : {Engine::Fits, Engine::Linear}) {
+        for (size_t chunk_size : {1, 7, 100, 100000}) {
+            ChunkedRenderer renderer{doc, 30, chunk_size, engine};
+            std::string out;
+            std::vector<size_t> sizes;
+            while (auto chunk = renderer.next()) {
+                out.append(*chunk);
+                sizes.push_back(chunk->size());
+            }
+            CHECK_EQ(doc.pretty(30, engine), out);
+            CHECK(std::all_of(sizes.begin(), sizes.end() - 1, [&](size_t size) { return size >= chunk_size; }));
+            CHECK(!renderer.next());
+        }
+    }
+
+    ChunkedRenderer empty{Doc::nil(), 80};
+    CHECK(!empty.next());
+
+    // Only as much of the doc as the chunks taken so far is built, and the rest is dropped with the renderer.
+    int made = 0;
+    auto lines = Doc::generate(1000000, [&made](size_t i) {
+        made++;
+        return Doc::s(std::to_string(i)) + Doc::line();
+    });
+
+    ChunkedRenderer renderer{lines, 80, 8};
+    CHECK_EQ("0\n1\n2\n3\n", renderer.next());
+    CHECK_EQ("4\n5\n6\n7\n", renderer.next());
+    CHECK(made <= 16);
+
+    // The renderer may move to another thread between chunks.
+    auto moved = std::move(renderer);
+    CHECK(!renderer.next());
+    std::thread{[&moved] { CHECK_EQ("8\n9\n10\n11", moved.next()); }}.join();
+}
+
+TEST_CASE("arena") {
+    auto heap = Doc::sv("heap allocated");
+
+    {
+        DocArena arena;
+        DocArena::Scope scope{arena};
+        CHECK_EQ(&arena, DocArena::current());
+
+        auto doc = tag("a", tag("b") + heap);
+        check_pretty("<a><b />heap allocated</a>", doc);
+
+        Doc res;
+        for (int i = 0; i < 3; i++) {
+            res += Doc::sv("item") + Doc::line();
+        }
+        res.append(std::array<Doc, 2>{heap, Doc::sv("done")});
+        check_pretty("item\nitem\nitem\nheap allocateddone", res);
+    }
+
+    {
+        DocArena arena;
+        DocArena::Scope scope{arena};
+
+        // measuring a generated doc walks its children, which must not be nested once per element.
+        std::vector<Doc> words(1000000, Doc::c('w'));
+        words[0] = Doc::lazy([] { return Doc::c('w'); });
+        auto measure = [](Doc doc) { return Doc::generate(2, [doc](size_t i) { return i == 0 ? doc : Doc::line(); }); };
+        CHECK_EQ(1000000, measure(join(words)).pretty(10, Engine::Linear).find('\n'));
+        CHECK_EQ(1999999, measure(sep(Doc::softline(), words)).pretty(2000000, Engine::Linear).find('\n'));
+    }
+
+    CHECK_EQ(nullptr, DocArena::current());
+    check_pretty("heap allocated", heap);
+}
+
+TEST_CASE("arena threads") {
+    std::array<std::string, 4> results;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < results.size(); i++) {
+        workers.emplace_back([&results, i] {
+            DocArena arena;
+            DocArena::Scope scope{arena};
+            results[i] = tag("t", Doc::s(std::to_string(i))).pretty(80);
+        });
+    }
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        CHECK_EQ("<t>" + std::to_string(i) + "</t>", results[i]);
+    }
+}
+
 TEST_CASE("concat") {
     check_pretty("ab", Doc::concat(Doc::sv("a"), Doc::sv("b")));
     check_pretty("ab", Doc::concat(Doc::sv("a"), "b"));